@@ -1,6 +1,11 @@
 #!/bin/bash
 set -Eeuo pipefail
 
+# maps of the objects pinned by name, which ip link pins into one directory
+IP_LINK_PIN_DIR=/sys/fs/bpf/xdp/globals
+MAP_NAMES="keepalive_stats tunnel_liveness liveness_events ratelimit_config peer_allowlist
+    keepalive_profiles tunnel_endpoints xsks_map netdev_families"
+
 # Usage: 
 #   try_load tunnel_type xdp_executable tunnel_config
 try_load() {
@@ -14,10 +19,167 @@ try_load() {
     ip link del ${TUNNEL_INTERFACE_NAME} || true
     ip link add ${TUNNEL_INTERFACE_NAME} type ${TUNNEL_TYPE} ${TUNNEL_CONFIG}
     ip link set ${TUNNEL_INTERFACE_NAME} up
-    ip link set dev ${TUNNEL_INTERFACE_NAME} xdp object "${XDP_EXECUTABLE}"
+    ip link set dev ${TUNNEL_INTERFACE_NAME} xdp object "${XDP_EXECUTABLE}" section xdp
+    ip link del ${TUNNEL_INTERFACE_NAME}
+    for MAP in ${MAP_NAMES}; do
+        rm -f ${IP_LINK_PIN_DIR}/${MAP}
+    done
+}
+
+# Usage:
+#   try_daemon tunnel_type tunnel_config
+try_daemon() {
+    TUNNEL_TYPE=$1
+    TUNNEL_CONFIG=${@:2}
+    TUNNEL_INTERFACE_NAME=test1
+
+    echo "Testing xdp_gre_keepalived on ${TUNNEL_TYPE}..."
+
+    ip link del ${TUNNEL_INTERFACE_NAME} || true
+    ip link add ${TUNNEL_INTERFACE_NAME} type ${TUNNEL_TYPE} ${TUNNEL_CONFIG}
+    ip link set ${TUNNEL_INTERFACE_NAME} up
+    build/xdp_gre_keepalived ${TUNNEL_INTERFACE_NAME} &
+    DAEMON_PID=$!
+    sleep 1
+    ip link show dev ${TUNNEL_INTERFACE_NAME} | grep -q xdp
+    # hand over to a second instance, the program has to stay attached
+    kill -USR2 ${DAEMON_PID}
+    wait ${DAEMON_PID}
+    ip link show dev ${TUNNEL_INTERFACE_NAME} | grep -q xdp
+    # with the debug output on, which the verifier has to accept as well
+    build/xdp_gre_keepalived -v -x 64 ${TUNNEL_INTERFACE_NAME} > /tmp/xdp-gre-upgrade.log &
+    DAEMON_PID=$!
+    sleep 1
+    grep -q "replaced program" /tmp/xdp-gre-upgrade.log
+    rm -f /tmp/xdp-gre-upgrade.log
+    kill -TERM ${DAEMON_PID}
+    wait ${DAEMON_PID}
+    if ip link show dev ${TUNNEL_INTERFACE_NAME} | grep -q xdp; then
+        echo "program still attached after SIGTERM"
+        exit 1
+    fi
+    ip link del ${TUNNEL_INTERFACE_NAME}
+}
+
+# A daemon started without -A after one with it reuses the pinned maps, and
+# must not keep answering with the old allow-list.
+# Usage:
+#   try_allowlist_restart tunnel_type tunnel_config
+try_allowlist_restart() {
+    TUNNEL_TYPE=$1
+    TUNNEL_CONFIG=${@:2}
+    TUNNEL_INTERFACE_NAME=test1
+    PIN_DIR=/sys/fs/bpf/gre_keepalive
+
+    echo "Testing xdp_gre_keepalived restart without an allow-list on ${TUNNEL_TYPE}..."
+
+    ip link del ${TUNNEL_INTERFACE_NAME} || true
+    ip link add ${TUNNEL_INTERFACE_NAME} type ${TUNNEL_TYPE} ${TUNNEL_CONFIG}
+    ip link set ${TUNNEL_INTERFACE_NAME} up
+    echo "198.51.100.0/24" > /tmp/xdp-gre-allow.conf
+    build/xdp_gre_keepalived -A /tmp/xdp-gre-allow.conf ${TUNNEL_INTERFACE_NAME} &
+    DAEMON_PID=$!
+    sleep 1
+    bpftool map lookup pinned ${PIN_DIR}/keepalive_dual/peer_allowlist key 0 0 0 0 > /dev/null
+    kill -USR2 ${DAEMON_PID}
+    wait ${DAEMON_PID}
+    build/xdp_gre_keepalived ${TUNNEL_INTERFACE_NAME} &
+    DAEMON_PID=$!
+    sleep 1
+    if bpftool map lookup pinned ${PIN_DIR}/keepalive_dual/peer_allowlist key 0 0 0 0 > /dev/null 2>&1; then
+        echo "allow-list of the previous daemon still installed"
+        exit 1
+    fi
+    kill -TERM ${DAEMON_PID}
+    wait ${DAEMON_PID}
+    rm -f /tmp/xdp-gre-allow.conf
+    ip link del ${TUNNEL_INTERFACE_NAME}
+}
+
+# The daemon only loads, xdp-loader attaches a copy behind the libxdp
+# dispatcher that shares the daemon's maps. Skipped without xdp-tools.
+# Usage:
+#   try_dispatcher tunnel_type tunnel_config
+try_dispatcher() {
+    TUNNEL_TYPE=$1
+    TUNNEL_CONFIG=${@:2}
+    TUNNEL_INTERFACE_NAME=test1
+    PIN_DIR=/sys/fs/bpf/gre_keepalive
+
+    if ! command -v xdp-loader > /dev/null; then
+        echo "Skipping the libxdp dispatcher test, no xdp-loader"
+        return
+    fi
+    echo "Testing xdp_gre_keepalived --no-attach on ${TUNNEL_TYPE}..."
+
+    ip link del ${TUNNEL_INTERFACE_NAME} || true
+    ip link add ${TUNNEL_INTERFACE_NAME} type ${TUNNEL_TYPE} ${TUNNEL_CONFIG}
+    ip link set ${TUNNEL_INTERFACE_NAME} up
+    build/xdp_gre_keepalived -n ${TUNNEL_INTERFACE_NAME} &
+    DAEMON_PID=$!
+    sleep 1
+    if ip link show dev ${TUNNEL_INTERFACE_NAME} | grep -q xdp; then
+        echo "program attached despite --no-attach"
+        exit 1
+    fi
+    xdp-loader load -m skb -p ${PIN_DIR}/keepalive_dual ${TUNNEL_INTERFACE_NAME} build/keepalive_dual.o
+    # one dispatcher, with our program in its first slot
+    xdp-loader status ${TUNNEL_INTERFACE_NAME} | grep -q xdp_keepalive_dual
+    # both copies use the maps the daemon pinned
+    STATS_ID=$(bpftool map show pinned ${PIN_DIR}/keepalive_dual/keepalive_stats | cut -d: -f1)
+    [ "$(bpftool prog show name xdp_keepalive_dual | grep -cE "map_ids (.*,)?${STATS_ID}(,|$)")" -eq 2 ]
+    xdp-loader unload -a ${TUNNEL_INTERFACE_NAME}
+    kill -TERM ${DAEMON_PID}
+    wait ${DAEMON_PID}
     ip link del ${TUNNEL_INTERFACE_NAME}
 }
 
+# Two namespaces joined by a veth pair with a gre tunnel between them. The
+# daemon in ka-a sends keepalives, the plain kernel in ka-b sends them back.
+# Usage:
+#   try_sender
+try_sender() {
+    PIN_DIR=/run/xdp-gre-test-bpf
+
+    echo "Testing xdp_gre_keepalived keepalive sender..."
+
+    ip netns del ka-a 2>/dev/null || true
+    ip netns del ka-b 2>/dev/null || true
+    ip netns add ka-a
+    ip netns add ka-b
+    ip link add veth-a netns ka-a type veth peer name veth-b netns ka-b
+    ip -n ka-a addr add 10.200.0.1/24 dev veth-a
+    ip -n ka-b addr add 10.200.0.2/24 dev veth-b
+    ip -n ka-a link add gre-a type gre local 10.200.0.1 remote 10.200.0.2 ttl 255
+    ip -n ka-b link add gre-b type gre local 10.200.0.2 remote 10.200.0.1 ttl 255
+    for ns in ka-a ka-b; do
+        ip -n ${ns} link set lo up
+        ip netns exec ${ns} sh -c 'for l in $(ls /sys/class/net); do ip link set $l up; done'
+    done
+    # the reflected packet has one of ka-b's own addresses as its source
+    ip netns exec ka-b sysctl -qw net.ipv4.ip_forward=1 net.ipv4.conf.all.accept_local=1 \
+        net.ipv4.conf.all.rp_filter=0 net.ipv4.conf.gre-b.rp_filter=0 net.ipv4.conf.gre-b.accept_local=1
+
+    # `ip netns exec` remounts /sys, so pin outside of it
+    mkdir -p ${PIN_DIR}
+    mountpoint -q ${PIN_DIR} || mount -t bpf bpf ${PIN_DIR}
+    echo "10.200.0.1 10.200.0.2" > ${PIN_DIR}.tunnels
+    ip netns exec ka-a build/xdp_gre_keepalived -d ${PIN_DIR}/gre_keepalive -T ${PIN_DIR}.tunnels -k 1 gre-a > ${PIN_DIR}.log &
+    DAEMON_PID=$!
+    sleep 3
+    REPLIES=$(build/xdp_gre_stats -p ${PIN_DIR}/gre_keepalive/keepalive_dual/keepalive_stats | awk '$1 == "keepalive-reply" { print $2 }')
+    kill -TERM ${DAEMON_PID}
+    wait ${DAEMON_PID}
+    echo "${REPLIES} keepalive replies"
+    [ "${REPLIES}" -gt 0 ]
+    grep -q "tunnel 10.200.0.1 10.200.0.2 up" ${PIN_DIR}.log
+
+    ip netns del ka-a
+    ip netns del ka-b
+    umount ${PIN_DIR}
+    rm -f ${PIN_DIR}.tunnels ${PIN_DIR}.log
+}
+
 if [ $EUID -ne 0 ]; then
     echo "This script must be run as root"
     exit 1
@@ -29,3 +191,19 @@ modprobe ip_gre
 
 try_load gre build/keepalive_gre.o local 169.254.1.1 remote 169.254.1.2 ttl 255
 try_load ip6gre build/keepalive_gre6.o local fd00::1 remote fd00::2 ttl 255
+try_load gre build/keepalive_dual.o local 169.254.1.1 remote 169.254.1.2 ttl 255
+try_load ip6gre build/keepalive_dual.o local fd00::1 remote fd00::2 ttl 255
+try_load dummy build/keepalive_underlay.o
+try_load dummy build/keepalive_pipeline.o
+
+try_daemon gre local 169.254.1.1 remote 169.254.1.2 ttl 255
+try_daemon ip6gre local fd00::1 remote fd00::2 ttl 255
+try_allowlist_restart gre local 169.254.1.1 remote 169.254.1.2 ttl 255
+try_dispatcher gre local 169.254.1.1 remote 169.254.1.2 ttl 255
+
+try_sender
+
+build/xdp_gre_replay -o build -r 1000 tests/replay
+# the base branch's figures are measured here, the verifier depends on the kernel
+build/xdp_gre_verifier_stats -u -b build/verifier-stats.base build/base/build/keepalive_*.o
+build/xdp_gre_verifier_stats -n -b build/verifier-stats.base build/keepalive_*.o
@@ -0,0 +1,425 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0
+#
+# Generate the captures under tests/replay/ together with their golden
+# .expect files. Only the standard library is used so the captures can be
+# rebuilt anywhere; the frames mimic what Cisco IOS XE and MikroTik RouterOS
+# send. After a deliberate change in behaviour, regenerate the expectations
+# from the programs themselves with `build/xdp_gre_replay -u tests/replay`.
+#
+# Usage: scripts/gen_replay_pcaps.py [REPLAY_DIR]
+
+import os
+import socket
+import struct
+import sys
+
+LINKTYPE_ETHERNET = 1
+LINKTYPE_RAW = 101
+
+IPPROTO_ICMP = 1
+IPPROTO_UDP = 17
+IPPROTO_GRE = 47
+IPPROTO_FRAGMENT = 44
+IPPROTO_DSTOPTS = 60
+
+ETH_P_IP = 0x0800
+ETH_P_ARP = 0x0806
+ETH_P_IPV6 = 0x86DD
+ETH_P_TEB = 0x6558
+ETH_P_8021Q = 0x8100
+ETH_P_8021AD = 0x88A8
+
+GRE_KEY = 0x2000
+
+LOCAL4, REMOTE4, KEYED_REMOTE4 = "192.0.2.1", "192.0.2.2", "192.0.2.3"
+LOCAL6, REMOTE6 = "2001:db8::1", "2001:db8::2"
+# inner addresses of the IPv4 and the IPv6 tunnel in the other family, as
+# listed in tunnels.conf
+INNER6_LOCAL, INNER6_REMOTE = "2001:db8:100::1", "2001:db8:100::2"
+INNER4_LOCAL, INNER4_REMOTE = "203.0.113.1", "203.0.113.2"
+LOCAL_MAC, REMOTE_MAC = bytes.fromhex("020000000001"), bytes.fromhex("020000000002")
+# gretap interfaces at either end of the L2 tunnels
+TAP_LOCAL_MAC, TAP_REMOTE_MAC = bytes.fromhex("0200000000a1"), bytes.fromhex("0200000000a2")
+
+
+def csum(data):
+    if len(data) % 2:
+        data += b"\0"
+    s = sum(struct.unpack("!%dH" % (len(data) // 2), data))
+    while s >> 16:
+        s = (s & 0xFFFF) + (s >> 16)
+    return ~s & 0xFFFF
+
+
+def ipv4(src, dst, proto, payload, ident=0, options=b"", frag_off=0):
+    hdr = struct.pack("!BBHHHBBH4s4s", 0x45 + len(options) // 4, 0, 20 + len(options) + len(payload),
+                      ident, frag_off, 255, proto, 0, socket.inet_aton(src), socket.inet_aton(dst)) + options
+    return hdr[:10] + struct.pack("!H", csum(hdr)) + hdr[12:] + payload
+
+
+# router alert, as RSVP-aware routers add it
+IPOPT_RA = bytes.fromhex("94040000")
+IP_MF = 0x2000
+
+
+def with_ipv4_header(packet, byte0=None, tot_len=None):
+    # corrupt the version/ihl byte or the total length, checksum left as is
+    if byte0 is not None:
+        packet = bytes([byte0]) + packet[1:]
+    if tot_len is not None:
+        packet = packet[:2] + struct.pack("!H", tot_len) + packet[4:]
+    return packet
+
+
+def ipv6(src, dst, nexthdr, payload):
+    return struct.pack("!IHBB16s16s", 6 << 28, len(payload), nexthdr, 255,
+                       socket.inet_pton(socket.AF_INET6, src),
+                       socket.inet_pton(socket.AF_INET6, dst)) + payload
+
+
+def dstopts(nexthdr):
+    # PadN up to 8 bytes
+    return struct.pack("!BBBB4x", nexthdr, 0, 1, 4)
+
+
+def frag(nexthdr, offset_more):
+    return struct.pack("!BBHI", nexthdr, 0, offset_more, 0x1234)
+
+
+def gre(proto, key=None, version=0):
+    if key is None:
+        return struct.pack("!HH", version, proto)
+    return struct.pack("!HHI", GRE_KEY | version, proto, key)
+
+
+def eth(dst, src, proto, payload, pad=True):
+    frame = dst + src + struct.pack("!H", proto) + payload
+    # what a NIC hands over for a runt frame
+    if pad and len(frame) < 60:
+        frame += b"\0" * (60 - len(frame))
+    return frame
+
+
+def pseudo_eth(payload):
+    # ip6gre netdevs put a pseudo Ethernet header in front of the IPv6
+    # header, whose MAC bytes are whatever the netdev has; this destination
+    # starts like an IPv4 header
+    return eth(bytes.fromhex("45000000aa01"), bytes.fromhex("020000000002"), ETH_P_IPV6, payload, pad=False)
+
+
+def udp(payload):
+    return struct.pack("!HHHH", 4789, 4789, 8 + len(payload), 0) + payload
+
+
+def icmp_echo():
+    body = struct.pack("!BBHHH", 8, 0, 0, 1, 1) + b"keepalive?" * 4
+    return body[:2] + struct.pack("!H", csum(body)) + body[4:]
+
+
+# Cisco-style keepalive arriving on our side: the outer header from the peer,
+# the inner packet already addressed back to it
+def keepalive4(local=LOCAL4, remote=REMOTE4, key=None, inner_src=None, options=b"", frag_off=0):
+    inner = ipv4(inner_src or local, remote, IPPROTO_GRE, gre(0, key), ident=0x1c46)
+    return ipv4(remote, local, IPPROTO_GRE, gre(ETH_P_IP, key) + inner, ident=0x2b3e, options=options,
+                frag_off=frag_off), inner
+
+
+# MikroTik uses the IPv6 EtherType as protocol of the inner GRE header
+def keepalive6(local=LOCAL6, remote=REMOTE6, ext=False):
+    if ext:
+        inner = ipv6(local, remote, IPPROTO_DSTOPTS, dstopts(IPPROTO_GRE) + gre(ETH_P_IPV6))
+        return ipv6(remote, local, IPPROTO_DSTOPTS, dstopts(IPPROTO_GRE) + gre(ETH_P_IPV6) + inner), inner
+    inner = ipv6(local, remote, IPPROTO_GRE, gre(ETH_P_IPV6))
+    return ipv6(remote, local, IPPROTO_GRE, gre(ETH_P_IPV6) + inner), inner
+
+
+# keepalives of the other family than the tunnel: the inner packet carries
+# the tunnel's inner addresses, which the programs find in tunnel_endpoints
+def keepalive6in4(local=INNER6_LOCAL, remote=INNER6_REMOTE):
+    inner = ipv6(local, remote, IPPROTO_GRE, gre(ETH_P_IPV6))
+    return ipv4(REMOTE4, LOCAL4, IPPROTO_GRE, gre(ETH_P_IPV6) + inner, ident=0x2b3f), inner
+
+
+def keepalive4in6(local=INNER4_LOCAL, remote=INNER4_REMOTE):
+    inner = ipv4(local, remote, IPPROTO_GRE, gre(0), ident=0x1c47)
+    return ipv6(REMOTE6, LOCAL6, IPPROTO_GRE, gre(ETH_P_IP) + inner), inner
+
+
+def tunnels_conf(comment):
+    return ("# %s\n" % comment +
+            "%s %s inner %s %s\n" % (LOCAL4, REMOTE4, INNER6_LOCAL, INNER6_REMOTE) +
+            "%s %s 42\n" % (LOCAL4, KEYED_REMOTE4) +
+            "%s %s inner %s %s\n" % (LOCAL6, REMOTE6, INNER4_LOCAL, INNER4_REMOTE))
+
+
+# L2 tunnels (gretap, ip6gretap) carry the same keepalive behind an Ethernet
+# header addressed to the peer's tap interface
+def keepalive_tap4(local=LOCAL4, remote=REMOTE4):
+    inner = ipv4(local, remote, IPPROTO_GRE, gre(0), ident=0x1c48)
+    l2 = eth(TAP_REMOTE_MAC, TAP_LOCAL_MAC, ETH_P_IP, inner, pad=False)
+    return ipv4(remote, local, IPPROTO_GRE, gre(ETH_P_TEB) + l2, ident=0x2b40), inner
+
+
+def keepalive_tap6(local=LOCAL6, remote=REMOTE6):
+    inner = ipv6(local, remote, IPPROTO_GRE, gre(ETH_P_IPV6))
+    l2 = eth(TAP_REMOTE_MAC, TAP_LOCAL_MAC, ETH_P_IPV6, inner, pad=False)
+    return ipv6(remote, local, IPPROTO_GRE, gre(ETH_P_TEB) + l2), inner
+
+
+def passed(frame):
+    return frame, "XDP_PASS", None
+
+
+def dropped(frame):
+    return frame, "XDP_DROP", None
+
+
+def reflected(frame, out):
+    return frame, "XDP_TX", out
+
+
+def underlay_reflected(frame, inner, proto=None, tags=0):
+    # MAC addresses swapped, VLAN tags kept, EtherType of the inner packet,
+    # everything after the inner packet (padding) kept
+    l2_len = 14 + 4 * tags
+    start = frame.index(inner, l2_len)
+    ethertype = struct.pack("!H", proto) if proto else frame[l2_len - 2:l2_len]
+    return reflected(frame, frame[6:12] + frame[0:6] + frame[12:l2_len - 2] + ethertype + frame[start:])
+
+
+def vlan_tagged(tags, proto, payload):
+    # tags are (TPID, VLAN id) from the outermost one in; returns the
+    # EtherType and payload for eth()
+    ethertype = tags[0][0]
+    body = b""
+    for i, (_, vid) in enumerate(tags):
+        inner_type = tags[i + 1][0] if i + 1 < len(tags) else proto
+        body += struct.pack("!HH", vid, inner_type)
+    return ethertype, body + payload
+
+
+def gre_captures():
+    ka, inner = keepalive4()
+    ka_keyed, inner_keyed = keepalive4(key=42)
+    reply = ipv4(REMOTE4, LOCAL4, IPPROTO_GRE, gre(0))
+    cisco = [reflected(ka, inner), reflected(ka_keyed, inner_keyed), dropped(reply)]
+
+    data = [
+        passed(ipv4(REMOTE4, LOCAL4, IPPROTO_GRE, gre(ETH_P_IP) +
+                    ipv4("198.51.100.1", "198.51.100.2", IPPROTO_UDP, udp(b"x" * 64)))),
+        passed(ipv4(REMOTE4, LOCAL4, IPPROTO_GRE, gre(ETH_P_IP) +
+                    ipv4("198.51.100.1", "198.51.100.2", IPPROTO_ICMP, icmp_echo()))),
+        passed(ipv4(REMOTE4, LOCAL4, IPPROTO_GRE, gre(ETH_P_IPV6) +
+                    ipv6("2001:db8:1::1", "2001:db8:1::2", IPPROTO_UDP, udp(b"x" * 64)))),
+    ]
+
+    addr_mismatch, _ = keepalive4(inner_src="198.51.100.2")
+    key_mismatch = ipv4(REMOTE4, LOCAL4, IPPROTO_GRE, gre(ETH_P_IP, 42) +
+                        ipv4(LOCAL4, REMOTE4, IPPROTO_GRE, gre(0, 43)))
+    malformed = [
+        dropped(ipv4(REMOTE4, LOCAL4, IPPROTO_GRE, b"\0\0")),              # short outer GRE
+        dropped(ipv4(REMOTE4, LOCAL4, IPPROTO_GRE, gre(ETH_P_IP) + ka[24:34])),  # short inner IP
+        dropped(ipv4(REMOTE4, LOCAL4, IPPROTO_GRE, b"")[:16]),             # short outer IP
+        passed(addr_mismatch),
+        passed(key_mismatch),
+        passed(ipv4(REMOTE4, LOCAL4, IPPROTO_GRE, gre(0x880B, version=1) + b"\0" * 16)),  # PPTP
+        dropped(with_ipv4_header(ka, byte0=0x44)),                         # ihl below 5
+        dropped(with_ipv4_header(ka, tot_len=16)),                         # total length below ihl
+        dropped(with_ipv4_header(ka, tot_len=len(ka) + 1)),                # total length past the end
+    ]
+    ka6in4, inner6in4 = keepalive6in4()
+    # inner addresses of the wrong tunnel, and none configured for the keyed one
+    wrong6in4, _ = keepalive6in4(LOCAL6, REMOTE6)
+    unconfigured = ipv4(KEYED_REMOTE4, LOCAL4, IPPROTO_GRE, gre(ETH_P_IPV6, 42) +
+                        ipv6(INNER6_LOCAL, INNER6_REMOTE, IPPROTO_GRE, gre(ETH_P_IPV6, 42)))
+    cross_family = [reflected(ka6in4, inner6in4), passed(wrong6in4), passed(unconfigured)]
+    return LINKTYPE_RAW, {"cisco": cisco, "data": data, "malformed": malformed, "cross-family": cross_family,
+                          "ip-options": ip_options_captures(lambda p: p, reflected)}
+
+
+# outer IPv4 headers with options and fragments, wrap() puts a packet in the
+# frame the program gets and reflect() builds the expected reflection
+def ip_options_captures(wrap, reflect):
+    ka, inner = keepalive4(options=IPOPT_RA)
+    ka_nop, inner_nop = keepalive4(options=IPOPT_RA + b"\x01" * 4)
+    first, _ = keepalive4(frag_off=IP_MF)
+    # a later fragment whose payload happens to look like a keepalive
+    later, _ = keepalive4(frag_off=8)
+    return [
+        reflect(wrap(ka), inner),
+        reflect(wrap(ka_nop), inner_nop),
+        passed(wrap(ipv4(REMOTE4, LOCAL4, IPPROTO_GRE, gre(ETH_P_IP) +
+                         ipv4("198.51.100.1", "198.51.100.2", IPPROTO_UDP, udp(b"x" * 64)), options=IPOPT_RA))),
+        passed(wrap(first)),
+        passed(wrap(later)),
+    ]
+
+
+def gre6_captures():
+    ka, inner = keepalive6()
+    ka_ext, inner_ext = keepalive6(ext=True)
+    reply = ipv6(REMOTE6, LOCAL6, IPPROTO_GRE, gre(0))
+    mikrotik = [
+        reflected(pseudo_eth(ka), inner),
+        reflected(pseudo_eth(ka_ext), inner_ext),
+        dropped(pseudo_eth(reply)),
+    ]
+
+    data = [
+        passed(pseudo_eth(ipv6(REMOTE6, LOCAL6, IPPROTO_GRE, gre(ETH_P_IPV6) +
+                               ipv6("2001:db8:1::1", "2001:db8:1::2", IPPROTO_UDP, udp(b"x" * 64))))),
+        # first fragment, left to the stack to reassemble
+        passed(pseudo_eth(ipv6(REMOTE6, LOCAL6, IPPROTO_FRAGMENT, frag(IPPROTO_GRE, 1) +
+                               gre(ETH_P_IPV6) + b"\0" * 64))),
+    ]
+
+    addr_mismatch = ipv6(REMOTE6, LOCAL6, IPPROTO_GRE, gre(ETH_P_IPV6) +
+                         ipv6(LOCAL6, "2001:db8:1::2", IPPROTO_GRE, gre(ETH_P_IPV6)))
+    malformed = [
+        dropped(pseudo_eth(ka[:20])),                                          # short outer IPv6
+        dropped(pseudo_eth(ipv6(REMOTE6, LOCAL6, IPPROTO_DSTOPTS, b"\0"))),    # short extension header
+        dropped(pseudo_eth(ka[:40 + 4 + 40 + 2])),                             # short inner GRE
+        passed(pseudo_eth(addr_mismatch)),
+    ]
+    ka4in6, inner4in6 = keepalive4in6()
+    wrong4in6, _ = keepalive4in6(LOCAL4, REMOTE4)
+    cross_family = [reflected(pseudo_eth(ka4in6), inner4in6), passed(pseudo_eth(wrong4in6))]
+    return LINKTYPE_ETHERNET, {"mikrotik": mikrotik, "data": data, "malformed": malformed, "cross-family": cross_family}
+
+
+def underlay_captures():
+    def frame(proto, payload, pad=True):
+        return eth(LOCAL_MAC, REMOTE_MAC, proto, payload, pad)
+
+    ka, inner = keepalive4()
+    ka_keyed, inner_keyed = keepalive4(remote=KEYED_REMOTE4, key=42)
+    unknown, _ = keepalive4(remote="198.51.100.9")
+    reply = ipv4(REMOTE4, LOCAL4, IPPROTO_GRE, gre(0))
+    cisco = [
+        underlay_reflected(frame(ETH_P_IP, ka), inner),
+        underlay_reflected(frame(ETH_P_IP, ka_keyed), inner_keyed),
+        dropped(frame(ETH_P_IP, reply)),
+        passed(frame(ETH_P_IP, unknown)),
+    ]
+
+    ka6, inner6 = keepalive6()
+    ka6_ext, inner6_ext = keepalive6(ext=True)
+    mikrotik = [
+        underlay_reflected(frame(ETH_P_IPV6, ka6), inner6),
+        underlay_reflected(frame(ETH_P_IPV6, ka6_ext), inner6_ext),
+    ]
+
+    arp = struct.pack("!HHBBH6s4s6s4s", 1, ETH_P_IP, 6, 4, 1, REMOTE_MAC, socket.inet_aton(REMOTE4),
+                      b"\0" * 6, socket.inet_aton(LOCAL4))
+    data = [
+        passed(frame(ETH_P_IP, ipv4(REMOTE4, LOCAL4, IPPROTO_GRE, gre(ETH_P_IP) +
+                                    ipv4("198.51.100.1", "198.51.100.2", IPPROTO_UDP, udp(b"x" * 64))))),
+        passed(frame(ETH_P_IP, ipv4(REMOTE4, LOCAL4, IPPROTO_UDP, udp(b"x" * 64)))),
+        passed(frame(ETH_P_ARP, arp)),
+    ]
+
+    # as captured with a short snaplen, no padding
+    malformed = [
+        dropped(frame(ETH_P_IP, ipv4(REMOTE4, LOCAL4, IPPROTO_GRE, b"\0\0"), pad=False)),
+        dropped(frame(ETH_P_IPV6, ka6[:20], pad=False)),
+        dropped(frame(ETH_P_IP, with_ipv4_header(ka, byte0=0x65))),       # IPv6 behind the IPv4 EtherType
+        dropped(frame(ETH_P_IP, with_ipv4_header(ka, tot_len=len(ka) + 1), pad=False)),
+    ]
+    ka6in4, inner6in4 = keepalive6in4()
+    ka4in6, inner4in6 = keepalive4in6()
+    wrong6in4, _ = keepalive6in4(LOCAL6, REMOTE6)
+    cross_family = [
+        underlay_reflected(frame(ETH_P_IP, ka6in4), inner6in4, ETH_P_IPV6),
+        underlay_reflected(frame(ETH_P_IPV6, ka4in6), inner4in6, ETH_P_IP),
+        passed(frame(ETH_P_IP, wrong6in4)),
+    ]
+    ip_options = ip_options_captures(lambda p: frame(ETH_P_IP, p), lambda f, inner: underlay_reflected(f, inner))
+    def tagged(tags, proto, payload):
+        return frame(*vlan_tagged(tags, proto, payload))
+
+    dot1q, qinq = [(ETH_P_8021Q, 100)], [(ETH_P_8021AD, 200), (ETH_P_8021Q, 100)]
+    vlan = [
+        underlay_reflected(tagged(dot1q, ETH_P_IP, ka), inner, tags=1),
+        underlay_reflected(tagged(dot1q, ETH_P_IPV6, ka6), inner6, tags=1),
+        underlay_reflected(tagged(qinq, ETH_P_IP, ka), inner, tags=2),
+        underlay_reflected(tagged(qinq, ETH_P_IP, ka6in4), inner6in4, ETH_P_IPV6, tags=2),
+        dropped(tagged(dot1q, ETH_P_IP, reply)),
+        passed(tagged(dot1q, ETH_P_IP, ipv4(REMOTE4, LOCAL4, IPPROTO_GRE, gre(ETH_P_IP) +
+                                            ipv4("198.51.100.1", "198.51.100.2", IPPROTO_UDP, udp(b"x" * 64))))),
+        # a third tag is more than the program looks through
+        passed(tagged(qinq + [(ETH_P_8021Q, 300)], ETH_P_IP, ka)),
+        passed(frame(ETH_P_8021Q, b"\0\x64", pad=False)),               # truncated tag
+    ]
+    ka_tap4, inner_tap4 = keepalive_tap4()
+    ka_tap6, inner_tap6 = keepalive_tap6()
+    gretap = [
+        underlay_reflected(frame(ETH_P_IP, ka_tap4), inner_tap4, ETH_P_IP),
+        underlay_reflected(frame(ETH_P_IPV6, ka_tap6), inner_tap6, ETH_P_IPV6),
+        passed(frame(ETH_P_IP, ipv4(REMOTE4, LOCAL4, IPPROTO_GRE, gre(ETH_P_TEB) +
+                                    eth(TAP_REMOTE_MAC, TAP_LOCAL_MAC, ETH_P_IP,
+                                        ipv4("198.51.100.1", "198.51.100.2", IPPROTO_UDP, udp(b"x" * 64)))))),
+        passed(frame(ETH_P_IP, ipv4(REMOTE4, LOCAL4, IPPROTO_GRE, gre(ETH_P_TEB) +
+                                    eth(TAP_REMOTE_MAC, TAP_LOCAL_MAC, ETH_P_ARP, b"\0" * 28)))),
+        # short inner Ethernet
+        dropped(frame(ETH_P_IP, ipv4(REMOTE4, LOCAL4, IPPROTO_GRE, gre(ETH_P_TEB) + b"\0" * 10), pad=False)),
+    ]
+    return LINKTYPE_ETHERNET, {"cisco": cisco, "mikrotik": mikrotik, "data": data, "malformed": malformed,
+                               "cross-family": cross_family, "ip-options": ip_options, "gretap": gretap, "vlan": vlan}
+
+
+def dual_captures():
+    # one program for both kinds of tunnel netdev has to agree with the
+    # per-family ones on all of their captures
+    captures = {}
+    for prefix, (linktype, family_captures) in (("gre", gre_captures()), ("gre6", gre6_captures())):
+        for name, packets in family_captures.items():
+            captures[prefix + "-" + name] = (linktype, packets)
+    return captures
+
+
+def with_linktype(linktype, captures):
+    return {name: (linktype, packets) for name, packets in captures.items()}
+
+
+def write_pcap(path, linktype, frames):
+    with open(path, "wb") as f:
+        f.write(struct.pack("<IHHiIII", 0xA1B2C3D4, 2, 4, 0, 0, 65535, linktype))
+        for i, frame in enumerate(frames):
+            f.write(struct.pack("<IIII", 1700000000 + i, 0, len(frame), len(frame)))
+            f.write(frame)
+
+
+def write_expect(path, pcap_name, results):
+    with open(path, "w") as f:
+        f.write("# verdict and, if changed, output frame of each packet in %s\n" % pcap_name)
+        f.write("# generated by scripts/gen_replay_pcaps.py\n")
+        for verdict, out in results:
+            f.write(verdict + (" " + out.hex() if out is not None else "") + "\n")
+
+
+def main():
+    replay_dir = sys.argv[1] if len(sys.argv) > 1 else os.path.join(os.path.dirname(__file__), "..", "tests", "replay")
+    objects = {
+        "keepalive_gre": with_linktype(*gre_captures()),
+        "keepalive_gre6": with_linktype(*gre6_captures()),
+        "keepalive_dual": dual_captures(),
+        "keepalive_underlay": with_linktype(*underlay_captures()),
+        # tail-called stages, has to answer exactly like the underlay program
+        "keepalive_pipeline": with_linktype(*underlay_captures()),
+    }
+    for obj, captures in objects.items():
+        obj_dir = os.path.join(replay_dir, obj)
+        os.makedirs(obj_dir, exist_ok=True)
+        for name, (linktype, packets) in captures.items():
+            write_pcap(os.path.join(obj_dir, name + ".pcap"), linktype, [p[0] for p in packets])
+            write_expect(os.path.join(obj_dir, name + ".expect"), name + ".pcap",
+                         [(p[1], p[2]) for p in packets])
+
+    for obj in objects:
+        with open(os.path.join(replay_dir, obj, "tunnels.conf"), "w") as f:
+            f.write(tunnels_conf("tunnels answered for, and their inner addresses, during the replay"))
+
+
+if __name__ == "__main__":
+    main()
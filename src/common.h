@@ -2,11 +2,267 @@
 #ifndef __COMMON_H__
 #define __COMMON_H__
 
+#include "common_kern_user.h"
+
+// Run configuration for the libxdp dispatcher, which runs several programs on
+// one interface in order of priority and moves on to the next one when a
+// program returns one of its chain call actions. Each object runs first and
+// chains on XDP_PASS, so the programs behind it see everything but keepalives.
+#if __has_include(<xdp/xdp_helpers.h>)
+#include <xdp/xdp_helpers.h>
+#else
+#define XDP_METADATA_SECTION ".xdp_run_config"
+#define XDP_RUN_CONFIG(f) _##f SEC(XDP_METADATA_SECTION)
+#endif
+
+// ahead of libxdp's default of 50
+#define KEEPALIVE_RUN_PRIO 10
+
+// The maps the daemon fills or reads are pinned by name, so a copy of the
+// object loaded by libxdp with the daemon's pin directory as pin root shares
+// them. Per-copy state is not pinned: the daemon pins every map under its own
+// directory anyway, and a loader like ip link pins by name into one global
+// directory, where every object it loads would find it.
+
 struct gre_hdr {
 	__be16 flags;
 	__be16 proto;
 };
 
+// what to do with packets we cannot parse, one of XDP_PASS, XDP_DROP or
+// XDP_ABORTED (which also fires the xdp:xdp_exception tracepoint). Set by
+// the loader before the program is loaded.
+const volatile __u32 malformed_action = XDP_DROP;
+
+// Features switched at load time. The values are frozen before the verifier
+// sees the program, so it removes the branches of whatever is disabled and
+// one object serves every configuration.
+const volatile bool debug_print = false;      // bpf_printk() what every packet goes through
+const volatile __u32 debug_header_size = 0;   // bytes of every packet to dump, at most DEBUG_HEADER_MAX
+const volatile bool stats_enabled = true;     // keepalive_stats counters
+const volatile bool ratelimit_enabled = true; // ratelimit_config and per-peer buckets
+const volatile bool profiles_enabled = true;  // keepalive_profiles, the built-in ones otherwise
+const volatile bool xsk_replies = false;      // the program hands replies to an AF_XDP socket
+
+static __always_inline void dump_header(void *data, void *data_end) {
+	__u8 *data_raw = data;
+
+	if (!debug_print || !debug_header_size) return;
+	bpf_printk("Packet header dump:\n");
+	#pragma unroll
+	for (int i = 0; i < DEBUG_HEADER_MAX; ++i) {
+		if (i >= debug_header_size) break;
+		// check for out of boarder access is necessary, kernel will run static analysis on our program
+		if ((void *)(data_raw + i + 1) > data_end) {
+			bpf_printk("Packet size too small, dump stopped\n");
+			break;
+		}
+		bpf_printk("#%d: %x\n", i, data_raw[i]);
+	}
+}
+
+static __always_inline bool reason_is_malformed(__u32 reason) {
+	return reason >= REASON_MALFORMED_FIRST;
+}
+
+// keepalives that are ours or that we refuse to reflect never reach the stack
+static __always_inline bool reason_is_dropped(__u32 reason) {
+	return reason == REASON_KEEPALIVE_REPLY
+		|| reason == REASON_NOT_ALLOWED
+		|| reason == REASON_RATE_LIMITED;
+}
+
+// per-CPU so the hot path can count without atomics or cache-line bouncing
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, __u32);
+	__type(value, __u64);
+	__uint(max_entries, REASON_MAX);
+	__uint(pinning, LIBBPF_PIN_BY_NAME);
+} keepalive_stats SEC(".maps");
+
+static __always_inline void count_reason(__u32 reason) {
+	if (!stats_enabled) return;
+	__u64 *counter = bpf_map_lookup_elem(&keepalive_stats, &reason);
+	if (counter) *counter += 1;
+}
+
+// a tunnel that has not been heard from for this long is down, set by the loader
+const volatile __u64 liveness_timeout_ns = 30ULL * 1000000000;
+
+// when each tunnel was last heard from, keyed by outer addresses and GRE key
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__type(key, struct tunnel_endpoint);
+	__type(value, struct liveness_info);
+	__uint(max_entries, MAX_TUNNELS);
+	__uint(pinning, LIBBPF_PIN_BY_NAME);
+} tunnel_liveness SEC(".maps");
+
+// Tunnels listed by userspace. The underlay programs only answer for these;
+// every program finds the inner addresses of cross-family keepalives here.
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__type(key, struct tunnel_endpoint);
+	__type(value, struct tunnel_inner);
+	__uint(max_entries, MAX_TUNNELS);
+	__uint(pinning, LIBBPF_PIN_BY_NAME);
+} tunnel_endpoints SEC(".maps");
+
+// struct liveness_event, one per tunnel coming up
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+	__uint(max_entries, 256 * 1024);
+	__uint(pinning, LIBBPF_PIN_BY_NAME);
+} liveness_events SEC(".maps");
+
+// written by userspace at any time, see struct ratelimit_config
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, struct ratelimit_config);
+	__uint(max_entries, 1);
+	__uint(pinning, LIBBPF_PIN_BY_NAME);
+} ratelimit_config SEC(".maps");
+
+// Token bucket counted in nanoseconds of credit: time since the last
+// keepalive refills it, each reflected keepalive costs interval_ns. Per-CPU,
+// so no atomics are needed; LRU, so spoofed sources cannot fill it up.
+struct ratelimit_bucket {
+	__u64 credit_ns;
+	__u64 last_ns;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+	__type(key, struct peer_addr);
+	__type(value, struct ratelimit_bucket);
+	__uint(max_entries, MAX_TUNNELS);
+} ratelimit_buckets SEC(".maps");
+
+// whether a keepalive from this peer may be reflected
+static __always_inline bool ratelimit_allow(struct peer_addr *peer) {
+	if (!ratelimit_enabled) return true;
+	__u32 zero = 0;
+	struct ratelimit_config *config = bpf_map_lookup_elem(&ratelimit_config, &zero);
+	if (!config || !config->interval_ns) return true;
+
+	__u64 now = bpf_ktime_get_ns();
+	struct ratelimit_bucket *bucket = bpf_map_lookup_elem(&ratelimit_buckets, peer);
+	if (!bucket) {
+		// a new peer starts with a full bucket, and its first keepalive is
+		// answered even if a config written to the map has a burst below
+		// one interval
+		struct ratelimit_bucket new_bucket = { .last_ns = now };
+		if (config->burst_ns > config->interval_ns)
+			new_bucket.credit_ns = config->burst_ns - config->interval_ns;
+		bpf_map_update_elem(&ratelimit_buckets, peer, &new_bucket, BPF_ANY);
+		return true;
+	}
+
+	__u64 credit = bucket->credit_ns + (now - bucket->last_ns);
+	if (credit > config->burst_ns) credit = config->burst_ns;
+	bucket->last_ns = now;
+	if (credit < config->interval_ns) {
+		bucket->credit_ns = credit;
+		return false;
+	}
+	bucket->credit_ns = credit - config->interval_ns;
+	return true;
+}
+
+// Optional allow-list of peer prefixes. Userspace fills a new trie and puts
+// it in the single slot, which swaps the whole list atomically; as long as
+// the slot is empty every peer is allowed.
+struct allowlist_trie {
+	__uint(type, BPF_MAP_TYPE_LPM_TRIE);
+	__type(key, struct allowlist_key);
+	__type(value, __u32);
+	__uint(max_entries, MAX_TUNNELS);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+	__uint(max_entries, 1);
+	__type(key, __u32);
+	__uint(pinning, LIBBPF_PIN_BY_NAME);
+	__array(values, struct allowlist_trie);
+} peer_allowlist SEC(".maps");
+
+static __always_inline bool allowlist_permits(struct peer_addr *peer) {
+	__u32 zero = 0;
+	void *trie = bpf_map_lookup_elem(&peer_allowlist, &zero);
+	if (!trie) return true;
+
+	struct allowlist_key key = { .prefixlen = 32 + 128, .peer = *peer };
+	return bpf_map_lookup_elem(trie, &key) != NULL;
+}
+
+// Whether a keepalive from this peer may be reflected: REASON_REFLECTED if so,
+// otherwise why not. Called right before bpf_xdp_adjust_head().
+static __always_inline __u32 check_peer(struct peer_addr *peer) {
+	if (!allowlist_permits(peer)) return REASON_NOT_ALLOWED;
+	if (!ratelimit_allow(peer)) return REASON_RATE_LIMITED;
+	return REASON_REFLECTED;
+}
+
+static __always_inline __u32 check_peer_ipv4(struct iphdr *outer_iphdr) {
+	struct peer_addr peer = { .family = TUNNEL_FAMILY_IPV4 };
+
+	peer.addr[0] = outer_iphdr->saddr;
+	return check_peer(&peer);
+}
+
+static __always_inline __u32 check_peer_ipv6(struct ipv6hdr *outer_ipv6hdr) {
+	struct peer_addr peer = { .family = TUNNEL_FAMILY_IPV6 };
+
+	__builtin_memcpy(peer.addr, &outer_ipv6hdr->saddr, sizeof(peer.addr));
+	return check_peer(&peer);
+}
+
+// the tunnel a packet arrived through, as seen from our side
+static __always_inline void tunnel_endpoint_ipv4(struct tunnel_endpoint *ep, struct iphdr *outer_iphdr) {
+	ep->family = TUNNEL_FAMILY_IPV4;
+	ep->local[0] = outer_iphdr->daddr;
+	ep->remote[0] = outer_iphdr->saddr;
+}
+
+static __always_inline void tunnel_endpoint_ipv6(struct tunnel_endpoint *ep, struct ipv6hdr *outer_ipv6hdr) {
+	ep->family = TUNNEL_FAMILY_IPV6;
+	__builtin_memcpy(ep->local, &outer_ipv6hdr->daddr, sizeof(ep->local));
+	__builtin_memcpy(ep->remote, &outer_ipv6hdr->saddr, sizeof(ep->remote));
+}
+
+// Called for every keepalive of a tunnel, ours or the peer's. Only a tunnel
+// that was never seen or had timed out produces an event, so the ring buffer
+// carries state changes rather than packets.
+static __always_inline void record_liveness(struct tunnel_endpoint *ep) {
+	__u64 now = bpf_ktime_get_ns();
+	struct liveness_info *info = bpf_map_lookup_elem(&tunnel_liveness, ep);
+
+	if (info) {
+		__u64 last_seen = info->last_seen;
+
+		info->last_seen = now;
+		__sync_fetch_and_add(&info->packets, 1);
+		if (now - last_seen <= liveness_timeout_ns) return;
+	} else {
+		struct liveness_info new_info = { .last_seen = now, .packets = 1 };
+
+		// lost the race against another CPU, or the map is full
+		if (bpf_map_update_elem(&tunnel_liveness, ep, &new_info, BPF_NOEXIST)) return;
+	}
+
+	struct liveness_event *event = bpf_ringbuf_reserve(&liveness_events, sizeof(*event), 0);
+	if (!event) return;
+	event->endpoint = *ep;
+	event->timestamp = now;
+	event->state = TUNNEL_UP;
+	event->pad = 0;
+	bpf_ringbuf_submit(event, 0);
+}
+
 // have to be static and __always_inline, otherwise you will have `Error fetching program/map!`
 static __always_inline bool compare_ipv6_address(struct in6_addr *a, struct in6_addr *b) {
 	#pragma unroll
@@ -16,4 +272,440 @@ static __always_inline bool compare_ipv6_address(struct in6_addr *a, struct in6_
 	return true;
 }
 
-#endif
\ No newline at end of file
+// The parsers below take the current parsed header position and move it past
+// whatever they consumed. Keepalive matchers return REASON_REFLECTED when the
+// packet is a keepalive that should be sent back, or the reason it is not.
+
+// GRE flags and version, in host byte order (RFC 2784, RFC 2890)
+#define GRE_FLAG_CSUM    0x8000
+#define GRE_FLAG_ROUTING 0x4000
+#define GRE_FLAG_KEY     0x2000
+#define GRE_FLAG_SEQ     0x1000
+#define GRE_VERSION_MASK 0x0007
+
+struct gre_info {
+	__u16 flags;  // host byte order
+	__be16 proto;
+	__be32 key;   // only valid with GRE_FLAG_KEY
+};
+
+// Parse a GRE header including its optional checksum, key and sequence
+// number fields. Returns 0 on success, -1 if the header is truncated and 1
+// for headers we do not handle (source routing, or a version other than 0).
+static __always_inline int parse_gre(void **dataptr, void *data_end, struct gre_info *gre) {
+	void *pos = *dataptr;
+
+	if (pos + sizeof(struct gre_hdr) > data_end) return -1;
+	struct gre_hdr *grehdr = (struct gre_hdr *)pos;
+	pos += sizeof(struct gre_hdr);
+	gre->flags = bpf_ntohs(grehdr->flags);
+	gre->proto = grehdr->proto;
+	gre->key = 0;
+	if (debug_print) bpf_printk("GRE flags=0x%x proto=%x\n", gre->flags, gre->proto);
+	if (gre->flags & (GRE_FLAG_ROUTING | GRE_VERSION_MASK)) return 1;
+
+	if (gre->flags & GRE_FLAG_CSUM) pos += 4; // checksum + reserved
+	if (gre->flags & GRE_FLAG_KEY) {
+		if (pos + 4 > data_end) return -1;
+		gre->key = *(__be32 *)pos;
+		pos += 4;
+	}
+	if (gre->flags & GRE_FLAG_SEQ) pos += 4;
+	if (pos > data_end) return -1;
+
+	*dataptr = pos;
+	return 0;
+}
+
+static __always_inline void tunnel_endpoint_key(struct tunnel_endpoint *ep, struct gre_info *outer_gre) {
+	if (outer_gre->flags & GRE_FLAG_KEY) {
+		ep->flags = TUNNEL_F_KEY;
+		ep->key = outer_gre->key;
+	}
+}
+
+// Keepalives we originate carry GRE protocol 0 in their inner header, so
+// when the peer sends the inner packet back that is the outer protocol.
+static __always_inline bool is_keepalive_reply(struct gre_info *outer_gre) {
+	return outer_gre->proto == 0;
+}
+
+// record_liveness() for the tunnel dev programs, which have no endpoint at hand
+static __always_inline void record_liveness_ipv4(struct iphdr *outer_iphdr, struct gre_info *outer_gre) {
+	struct tunnel_endpoint ep = {};
+
+	tunnel_endpoint_ipv4(&ep, outer_iphdr);
+	tunnel_endpoint_key(&ep, outer_gre);
+	record_liveness(&ep);
+}
+
+static __always_inline void record_liveness_ipv6(struct ipv6hdr *outer_ipv6hdr, struct gre_info *outer_gre) {
+	struct tunnel_endpoint ep = {};
+
+	tunnel_endpoint_ipv6(&ep, outer_ipv6hdr);
+	tunnel_endpoint_key(&ep, outer_gre);
+	record_liveness(&ep);
+}
+
+// A keepalive on a keyed tunnel carries the tunnel key in both GRE headers,
+// the inner one is what the peer decapsulates when it comes back to us.
+static __always_inline bool gre_key_matches(struct gre_info *outer, struct gre_info *inner) {
+	if ((outer->flags ^ inner->flags) & GRE_FLAG_KEY) return false;
+	return outer->key == inner->key;
+}
+
+// written by userspace at any time, see struct keepalive_profile
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, struct keepalive_profile);
+	__uint(max_entries, PROFILE_MAX);
+	__uint(pinning, LIBBPF_PIN_BY_NAME);
+} keepalive_profiles SEC(".maps");
+
+// Whether the inner GRE header looks like a keepalive of a vendor we know,
+// with default_proto being the built-in profile. One map lookup per packet.
+static __always_inline __u32 match_profile(__u32 family, struct gre_info *outer, struct gre_info *inner, __be16 default_proto) {
+	struct keepalive_profile *profile = NULL;
+	bool proto_ok = false;
+
+	if (profiles_enabled) profile = bpf_map_lookup_elem(&keepalive_profiles, &family);
+
+	if (!profile || !profile->nr_protos) {
+		proto_ok = inner->proto == default_proto;
+	} else {
+		#pragma unroll
+		for (int i = 0; i < KEEPALIVE_PROTOS_MAX; ++i) {
+			if (i < profile->nr_protos && profile->protos[i] == inner->proto) proto_ok = true;
+		}
+	}
+	if (!proto_ok) return REASON_NOT_KEEPALIVE;
+
+	if (profile && (profile->flags & PROFILE_F_ANY_KEY)) return REASON_REFLECTED;
+	if (!gre_key_matches(outer, inner)) return REASON_KEY_MISMATCH;
+	return REASON_REFLECTED;
+}
+
+// headers of the packet as it arrived
+struct outer_headers {
+	struct iphdr *iphdr;     // exactly one of iphdr and ipv6hdr is set
+	struct ipv6hdr *ipv6hdr;
+	struct gre_info gre;
+	__be16 inner_proto;      // EtherType of the inner packet
+	void *cutoff_pos;        // start of the inner packet
+	struct tunnel_inner *inner; // tunnel_endpoints entry, if already looked up
+};
+
+static __always_inline void outer_tunnel_endpoint(struct tunnel_endpoint *ep, struct outer_headers *outer) {
+	if (outer->iphdr) tunnel_endpoint_ipv4(ep, outer->iphdr);
+	else tunnel_endpoint_ipv6(ep, outer->ipv6hdr);
+	tunnel_endpoint_key(ep, &outer->gre);
+}
+
+// The inner addresses configured for the tunnel if they are of family, else
+// NULL. Only keepalives of the other family than the outer header get here,
+// so the tunnel netdev programs look the tunnel up no sooner.
+static __always_inline struct tunnel_inner *tunnel_inner_of(struct outer_headers *outer, __u32 family) {
+	struct tunnel_inner *inner = outer->inner;
+
+	if (!inner) {
+		struct tunnel_endpoint ep = {};
+
+		outer_tunnel_endpoint(&ep, outer);
+		inner = bpf_map_lookup_elem(&tunnel_endpoints, &ep);
+	}
+	if (!inner || inner->family != family) return NULL;
+	return inner;
+}
+
+// Inner addresses are the outer ones swapped, or with an outer header of the
+// other family the tunnel's configured inner addresses, ours as the source.
+static __always_inline bool ipv4_mirrors_outer(struct iphdr *inner_iphdr, struct outer_headers *outer) {
+	if (outer->iphdr) {
+		return inner_iphdr -> saddr == outer->iphdr -> daddr
+			&& inner_iphdr -> daddr == outer->iphdr -> saddr;
+	}
+	struct tunnel_inner *inner = tunnel_inner_of(outer, TUNNEL_FAMILY_IPV4);
+	return inner && inner_iphdr -> saddr == inner->local[0] && inner_iphdr -> daddr == inner->remote[0];
+}
+
+static __always_inline bool ipv6_mirrors_outer(struct ipv6hdr *inner_ipv6hdr, struct outer_headers *outer) {
+	if (outer->ipv6hdr) {
+		return compare_ipv6_address(&(outer->ipv6hdr -> saddr), &(inner_ipv6hdr -> daddr))
+			&& compare_ipv6_address(&(outer->ipv6hdr -> daddr), &(inner_ipv6hdr -> saddr));
+	}
+	struct tunnel_inner *inner = tunnel_inner_of(outer, TUNNEL_FAMILY_IPV6);
+	return inner && compare_ipv6_address((struct in6_addr *)inner->local, &(inner_ipv6hdr -> saddr))
+		&& compare_ipv6_address((struct in6_addr *)inner->remote, &(inner_ipv6hdr -> daddr));
+}
+
+// inner IPv4 + GRE of a keepalive
+static __always_inline __u32 match_ipv4_keepalive(void **dataptr, void *data_end, struct outer_headers *outer) {
+	void *pos = *dataptr;
+
+	if (pos + 1 > data_end) return REASON_SHORT_INNER_IP;
+	struct iphdr *inner_iphdr = pos;
+	int ip_header_size = (inner_iphdr -> ihl) * 4;
+	if (pos + 20 > data_end) return REASON_SHORT_INNER_IP; // workaround kernel static check
+	if (pos + ip_header_size > data_end) return REASON_SHORT_INNER_IP;
+	pos += ip_header_size;
+	__u8 inner_ip_proto = inner_iphdr -> protocol;
+	if (debug_print) bpf_printk("IPv4 packet_size=0x%x, proto=0x%x\n", ip_header_size, inner_ip_proto);
+
+	// check if it is a GRE encapsulated in an IPv4 packet
+	if (inner_ip_proto != IPPROTO_GRE) return REASON_INNER_NOT_GRE;
+
+	// get the inner GRE header
+	struct gre_info inner_gre;
+	int ret = parse_gre(&pos, data_end, &inner_gre);
+	if (ret < 0) return REASON_SHORT_INNER_GRE;
+	if (ret > 0) return REASON_NOT_KEEPALIVE;
+	*dataptr = pos;
+
+	// check if the GRE header is keepalive
+	// we need:
+	// * proto accepted by the profile, 0 by default
+	// * same GRE key as the tunnel, unless the profile says otherwise
+	// * ip address match
+	//
+	__u32 reason = match_profile(PROFILE_INNER_IPV4, &outer->gre, &inner_gre, 0);
+	if (reason != REASON_REFLECTED) return reason;
+	if (!ipv4_mirrors_outer(inner_iphdr, outer)) return REASON_ADDR_MISMATCH;
+	if (debug_print) bpf_printk("GRE4 keepalive received!\n");
+	return REASON_REFLECTED;
+}
+
+// most extension headers we step over in front of GRE, keeps the loop bounded
+#ifndef IPV6_EXT_MAX
+#define IPV6_EXT_MAX 4
+#endif
+
+// not in the uapi headers
+struct ipv6_frag_hdr {
+	__u8 nexthdr;
+	__u8 reserved;
+	__be16 frag_off;
+	__be32 identification;
+};
+
+#define IPV6_FRAG_OFFSET_MORE 0xfff9 // offset and M flag, host byte order
+
+// Skip the extension headers in front of the upper layer header, starting
+// with nexthdr of the IPv6 header at *dataptr - 1. Returns the upper layer
+// protocol, or -1 if an extension header is truncated. A fragment other than
+// an atomic one, or a chain longer than IPV6_EXT_MAX, stops the walk and the
+// extension header's protocol is returned, which callers do not handle.
+static __always_inline int skip_ipv6_ext(void **dataptr, void *data_end, __u8 nexthdr) {
+	void *pos = *dataptr;
+
+	#pragma unroll
+	for (int i = 0; i < IPV6_EXT_MAX; ++i) {
+		if (nexthdr == IPPROTO_HOPOPTS || nexthdr == IPPROTO_DSTOPTS || nexthdr == IPPROTO_ROUTING) {
+			struct ipv6_opt_hdr *opt = pos;
+			if (pos + sizeof(*opt) > data_end) return -1;
+			nexthdr = opt->nexthdr;
+			pos += (opt->hdrlen + 1) * 8;
+		} else if (nexthdr == IPPROTO_AH) {
+			struct ipv6_opt_hdr *opt = pos;
+			if (pos + sizeof(*opt) > data_end) return -1;
+			nexthdr = opt->nexthdr;
+			pos += (opt->hdrlen + 2) * 4;
+		} else if (nexthdr == IPPROTO_FRAGMENT) {
+			struct ipv6_frag_hdr *frag = pos;
+			if (pos + sizeof(*frag) > data_end) return -1;
+			// needs reassembly, leave it to the stack
+			if (frag->frag_off & bpf_htons(IPV6_FRAG_OFFSET_MORE)) break;
+			nexthdr = frag->nexthdr;
+			pos += sizeof(*frag);
+		} else {
+			break;
+		}
+	}
+	if (debug_print) bpf_printk("IPv6 upper layer proto=0x%x\n", nexthdr);
+
+	*dataptr = pos;
+	return nexthdr;
+}
+
+// inner IPv6 + GRE of a keepalive
+static __always_inline __u32 match_ipv6_keepalive(void **dataptr, void *data_end, struct outer_headers *outer) {
+	void *pos = *dataptr;
+
+	if (pos + sizeof(struct ipv6hdr) + 1 > data_end) return REASON_SHORT_INNER_IP;
+	struct ipv6hdr *inner_ipv6hdr = (struct ipv6hdr *)(pos);
+	pos += sizeof(struct ipv6hdr);
+	int inner_ip_proto = skip_ipv6_ext(&pos, data_end, inner_ipv6hdr -> nexthdr);
+	if (inner_ip_proto < 0) return REASON_SHORT_INNER_IP;
+
+	// check if it is a GRE encapsulated in an IPv6 packet
+	if (inner_ip_proto != IPPROTO_GRE) return REASON_INNER_NOT_GRE;
+
+	// get the inner GRE header
+	struct gre_info inner_gre;
+	int ret = parse_gre(&pos, data_end, &inner_gre);
+	if (ret < 0) return REASON_SHORT_INNER_GRE;
+	if (ret > 0) return REASON_NOT_KEEPALIVE;
+	*dataptr = pos;
+
+	// check if the GRE packet is a keepalive packet, MikroTik RouterOS puts
+	// the IPv6 EtherType in there; other vendors can be added by a profile
+	__u32 reason = match_profile(PROFILE_INNER_IPV6, &outer->gre, &inner_gre, bpf_htons(ETH_P_IPV6));
+	if (reason != REASON_REFLECTED) return reason;
+	if (!ipv6_mirrors_outer(inner_ipv6hdr, outer)) return REASON_ADDR_MISMATCH;
+	if (debug_print) bpf_printk("GRE6 keepalive received!\n");
+	return REASON_REFLECTED;
+}
+
+
+// Shared by every program from the outer IP header on, so each one only has
+// to find where that header starts and how to send the reflected packet.
+
+// ip6gre netdevs put a 14 bytes Ethernet header with the IPv6 EtherType in
+// front of the IPv6 header. Only the EtherType and the IP version can be
+// verified.
+#define IP6GRE_HLEN 14
+
+static __always_inline bool is_ip6gre_frame(void *pos, void *data_end) {
+	if (pos + IP6GRE_HLEN + 1 > data_end) return false;
+	return ((__u16 *)pos)[6] == bpf_htons(ETH_P_IPV6)
+		&& (((__u8 *)pos)[IP6GRE_HLEN] & 0xF0) == 0x60;
+}
+
+// Outer IPv4 header at *dataptr, options included. Returns 0 with *dataptr
+// at the GRE header, -1 if the header is truncated, -2 if it is invalid and 1
+// if it does not carry GRE or only a fragment of it.
+static __always_inline int parse_outer_ipv4(void **dataptr, void *data_end, struct outer_headers *outer) {
+	void *pos = *dataptr;
+
+	if (pos + sizeof(struct iphdr) > data_end) return -1;
+	struct iphdr *iph = (struct iphdr *)pos;
+	outer->iphdr = iph;
+	if (iph->protocol != IPPROTO_GRE) return 1;
+
+	if (iph->version != 4 || iph->ihl < 5) return -2;
+	int ip_header_size = iph->ihl * 4;
+	if (pos + ip_header_size > data_end) return -1;
+	// trailing bytes are link layer padding, missing ones a truncated packet
+	int tot_len = bpf_ntohs(iph->tot_len);
+	if (tot_len < ip_header_size) return -2;
+	if (pos + tot_len > data_end) return -1;
+	// MF or a fragment offset, the payload is not a whole GRE packet
+	if (iph->frag_off & bpf_htons(0x3FFF)) return 1;
+
+	*dataptr = pos + ip_header_size;
+	return 0;
+}
+
+static __always_inline __u32 outer_ip_malformed_reason(int ret) {
+	return ret == -2 ? REASON_BAD_OUTER_IP : REASON_SHORT_OUTER_IP;
+}
+
+// Same for an outer IPv6 header, stepping over extension headers peers may
+// put in front of GRE.
+static __always_inline int parse_outer_ipv6(void **dataptr, void *data_end, struct outer_headers *outer) {
+	void *pos = *dataptr;
+
+	if (pos + sizeof(struct ipv6hdr) > data_end) return -1;
+	outer->ipv6hdr = (struct ipv6hdr *)pos;
+	pos += sizeof(struct ipv6hdr);
+	int proto = skip_ipv6_ext(&pos, data_end, outer->ipv6hdr->nexthdr);
+	if (proto < 0) return -1;
+	if (proto != IPPROTO_GRE) return 1;
+
+	*dataptr = pos;
+	return 0;
+}
+
+static __always_inline void record_liveness_outer(struct outer_headers *outer) {
+	if (outer->iphdr) record_liveness_ipv4(outer->iphdr, &outer->gre);
+	else record_liveness_ipv6(outer->ipv6hdr, &outer->gre);
+}
+
+// The outer GRE header, up to the inner packet. With listed_only, only the
+// tunnels in tunnel_endpoints are answered for. Returns REASON_REFLECTED if
+// the inner packet at outer->cutoff_pos may be a keepalive, otherwise why not.
+static __always_inline __u32 parse_outer_gre(void **dataptr, void *data_end, struct outer_headers *outer, bool listed_only) {
+	// now we are at the outer GRE header
+	int ret = parse_gre(dataptr, data_end, &outer->gre);
+	if (ret < 0) return REASON_SHORT_OUTER_GRE;
+	if (ret > 0) return REASON_GRE_UNSUPPORTED;
+
+	// here is all the headers we need to chop off before sending the packet back
+	outer->cutoff_pos = *dataptr;
+	outer->inner_proto = outer->gre.proto;
+
+	if (listed_only) {
+		struct tunnel_endpoint ep = {};
+
+		outer_tunnel_endpoint(&ep, outer);
+		outer->inner = bpf_map_lookup_elem(&tunnel_endpoints, &ep);
+		if (!outer->inner) return REASON_UNKNOWN_TUNNEL;
+	}
+
+	// a keepalive we sent came back, nothing for the kernel to do with it
+	if (is_keepalive_reply(&outer->gre)) {
+		// left to the caller, which may hand it to userspace instead
+		if (!xsk_replies) record_liveness_outer(outer);
+		return REASON_KEEPALIVE_REPLY;
+	}
+	return REASON_REFLECTED;
+}
+
+// The per-peer checks once the inner packet matched a keepalive.
+static __always_inline __u32 check_keepalive_peer(struct outer_headers *outer) {
+	// only known peers, and not faster than they should, can make us send
+	__u32 reason = outer->iphdr ? check_peer_ipv4(outer->iphdr) : check_peer_ipv6(outer->ipv6hdr);
+	if (reason != REASON_REFLECTED) return reason;
+
+	// the peer's keepalive tells us as much as a reply to ours
+	record_liveness_outer(outer);
+	return REASON_REFLECTED;
+}
+
+// The inner packet at *dataptr, of the family outer->inner_proto tells: the
+// keepalive matchers and the per-peer checks. Returns REASON_REFLECTED for a
+// keepalive to send back from outer->cutoff_pos on, otherwise why not.
+static __always_inline __u32 match_inner_keepalive(void **dataptr, void *data_end, struct outer_headers *outer) {
+	__u32 reason;
+
+	// parse inner IP header, of the outer family for a keepalive
+	if (outer->inner_proto == bpf_htons(ETH_P_IP)) {
+		reason = match_ipv4_keepalive(dataptr, data_end, outer);
+	} else if (outer->inner_proto == bpf_htons(ETH_P_IPV6)) {
+		reason = match_ipv6_keepalive(dataptr, data_end, outer);
+	} else {
+		// unknown protocol
+		if (debug_print) bpf_printk("Unknown proto %x inside GRE", outer->inner_proto);
+		return REASON_UNKNOWN_PROTO;
+	}
+	if (reason != REASON_REFLECTED) return reason;
+
+	return check_keepalive_peer(outer);
+}
+
+// Everything after the outer IP header of a packet on a tunnel netdev, which
+// carries the inner packet right behind the outer GRE header.
+static __always_inline __u32 handle_outer_gre(void **dataptr, void *data_end, struct outer_headers *outer) {
+	__u32 reason = parse_outer_gre(dataptr, data_end, outer, false);
+	if (reason != REASON_REFLECTED) return reason;
+	return match_inner_keepalive(dataptr, data_end, outer);
+}
+
+// Verdict for a tunnel netdev, where the reflected packet is whatever
+// follows the outer GRE header. May change *reason if stripping fails.
+static __always_inline __u32 tunnel_verdict(struct xdp_md *ctx, struct outer_headers *outer, __u32 *reason) {
+	void *data_start = (void *)(long)ctx->data;
+
+	if (reason_is_malformed(*reason)) return malformed_action;
+	if (reason_is_dropped(*reason)) return XDP_DROP;
+	if (*reason != REASON_REFLECTED) return XDP_PASS;
+
+	// remove the header and send the packet back
+	if (bpf_xdp_adjust_head(ctx, (int)(outer->cutoff_pos - data_start))) {
+		*reason = REASON_ADJUST_HEAD_FAILED;
+		return malformed_action;
+	}
+	return XDP_TX;
+}
+
+#endif
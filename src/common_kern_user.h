@@ -0,0 +1,153 @@
+#pragma once
+#ifndef __COMMON_KERN_USER_H__
+#define __COMMON_KERN_USER_H__
+
+// shared between the XDP programs and the userspace tools
+
+// why a packet left the program, index into the keepalive_stats map
+enum keepalive_reason {
+	REASON_NOT_IP = 0,         // outer header is not the IP version we handle
+	REASON_NOT_GRE,            // outer IP payload is not GRE
+	REASON_UNKNOWN_TUNNEL,     // no configured tunnel for the outer address pair
+	REASON_UNKNOWN_PROTO,      // outer GRE carries an unsupported protocol
+	REASON_GRE_UNSUPPORTED,    // outer GRE has source routing or a non-zero version
+	REASON_INNER_NOT_GRE,      // inner IP payload is not GRE, i.e. data traffic
+	REASON_NOT_KEEPALIVE,      // inner GRE proto is not the keepalive one
+	REASON_ADDR_MISMATCH,      // inner addresses do not mirror the outer ones
+	REASON_KEY_MISMATCH,       // inner GRE key differs from the tunnel's
+	REASON_REFLECTED,          // keepalive sent back with XDP_TX
+	REASON_KEEPALIVE_REPLY,    // a keepalive we originated came back, dropped
+	REASON_NOT_ALLOWED,        // peer is not in the allow-list, dropped
+	REASON_RATE_LIMITED,       // peer is over its keepalive budget, dropped
+	REASON_STAGE_FAILED,       // a pipeline stage is missing or lost the packet's state, passed
+
+	// everything from here on is handled according to malformed_action
+	REASON_SHORT_OUTER_IP,     // outer IP header runs past the end of the packet
+	REASON_SHORT_OUTER_GRE,    // outer GRE header (or its options) is truncated
+	REASON_SHORT_INNER_IP,     // inner IP header, or the inner Ethernet one of L2 tunnels, is truncated
+	REASON_SHORT_INNER_GRE,    // inner GRE header is truncated
+	REASON_ADJUST_HEAD_FAILED, // bpf_xdp_adjust_head() refused to strip headers
+	REASON_BAD_OUTER_IP,       // outer IPv4 version, ihl or total length is invalid
+	REASON_MAX,
+};
+
+#define REASON_MALFORMED_FIRST REASON_SHORT_OUTER_IP
+
+// slots of the pipeline_stages program array of keepalive_pipeline.o, each
+// stage hands the packet on to one of the next ones
+enum pipeline_stage {
+	STAGE_OUTER_IPV4 = 0,      // outer IPv4 header, behind the L2 stage
+	STAGE_OUTER_IPV6,          // outer IPv6 header and its extension headers
+	STAGE_GRE,                 // outer GRE header, tunnel lookup and replies
+	STAGE_MATCH_IPV4,          // inner IPv4 keepalive, peer checks and reflection
+	STAGE_MATCH_IPV6,          // inner IPv6 keepalive, peer checks and reflection
+	STAGE_MAX,
+};
+
+// tunnels the underlay program answers for
+#define MAX_TUNNELS 65536
+
+#define TUNNEL_FAMILY_IPV4 4
+#define TUNNEL_FAMILY_IPV6 6
+
+// tunnel_endpoint.flags
+#define TUNNEL_F_KEY (1U << 0)
+
+// outer address pair (and GRE key) of a tunnel as seen on received packets,
+// local is us. IPv4 addresses use the first word and leave the rest zeroed.
+struct tunnel_endpoint {
+	__u16 family;
+	__u16 flags;
+	__be32 key;    // GRE key, zero unless TUNNEL_F_KEY
+	__be32 local[4];
+	__be32 remote[4];
+};
+
+// Value of the tunnel_endpoints map: the tunnel's own addresses inside it,
+// which the keepalives of the other family than the outer header carry
+// instead of the outer addresses swapped. local is us, the source of the
+// inner packet the peer sends back.
+struct tunnel_inner {
+	__u32 family;  // TUNNEL_FAMILY_*, 0 if none are configured
+	__be32 local[4];
+	__be32 remote[4];
+};
+
+// outer source address of a keepalive, IPv4 uses the first word
+struct peer_addr {
+	__u32 family;
+	__be32 addr[4];
+};
+
+// key of the LPM tries in the peer_allowlist map, prefixlen counts the
+// family word too: 32 + the length of the address prefix
+struct allowlist_key {
+	__u32 prefixlen;
+	struct peer_addr peer;
+};
+
+// single value of the ratelimit_config map. Each peer (outer source address)
+// may have burst_ns / interval_ns keepalives reflected back to back and one
+// more every interval_ns after that, on every CPU. All zero disables the limit.
+struct ratelimit_config {
+	__u64 interval_ns;
+	__u64 burst_ns;
+};
+
+// index into the keepalive_profiles map, by family of the inner packet
+enum keepalive_profile_family {
+	PROFILE_INNER_IPV4 = 0,
+	PROFILE_INNER_IPV6,
+	PROFILE_MAX,
+};
+
+#define KEEPALIVE_PROTOS_MAX 4
+
+// keepalive_profile.flags
+#define PROFILE_F_ANY_KEY (1U << 0) // inner GRE key need not match the tunnel's
+
+// What peers put in the inner GRE header of their keepalives. A profile
+// without protocols (the initial all-zero value) stands for the built-in
+// one: 0 in IPv4 (Cisco), the IPv6 EtherType in IPv6 (MikroTik RouterOS).
+struct keepalive_profile {
+	__u32 flags;
+	__u32 nr_protos;
+	__be16 protos[KEEPALIVE_PROTOS_MAX];
+};
+
+// value of the tunnel_liveness map
+struct liveness_info {
+	__u64 last_seen; // bpf_ktime_get_ns() of the last keepalive or reply
+	__u64 packets;   // keepalives and replies seen
+};
+
+enum liveness_state {
+	TUNNEL_DOWN = 0,
+	TUNNEL_UP,
+};
+
+// pushed through the liveness_events ring buffer when a tunnel comes up,
+// userspace produces the TUNNEL_DOWN ones when a tunnel times out
+struct liveness_event {
+	struct tunnel_endpoint endpoint;
+	__u64 timestamp;
+	__u32 state;
+	__u32 pad;
+};
+
+// 802.1Q or 802.1ad tag between the MAC addresses and the EtherType, the
+// underlay program looks through at most VLAN_MAX_DEPTH of them (QinQ)
+struct vlan_hdr {
+	__be16 h_vlan_TCI;
+	__be16 h_vlan_encapsulated_proto;
+};
+
+#define VLAN_MAX_DEPTH 2
+
+// AF_XDP sockets the underlay program can hand keepalive replies to, by RX queue
+#define MAX_XSK_QUEUES 64
+
+// most bytes of each packet the programs dump when debug_header_size is set
+#define DEBUG_HEADER_MAX 64
+
+#endif
@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#include <stddef.h>
+#include <stdbool.h>
+#include <linux/bpf.h>
+#include <linux/in.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/icmp.h>
+#include <linux/icmpv6.h>
+#include <linux/udp.h>
+#include <linux/tcp.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+#include "common.h"
+
+char _license[4] SEC("license") = "GPL";
+
+// One program for gre and ip6gre netdevs alike, so a host with tunnels of
+// both families needs a single object.
+
+// tunnel family of every netdev the program is attached to, keyed by
+// ifindex and written by the loader
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__type(key, __u32);
+	__type(value, __u32);
+	__uint(max_entries, MAX_TUNNELS);
+	__uint(pinning, LIBBPF_PIN_BY_NAME);
+} netdev_families SEC(".maps");
+
+struct {
+	__uint(priority, KEEPALIVE_RUN_PRIO);
+	__uint(XDP_PASS, 1);
+} XDP_RUN_CONFIG(xdp_keepalive_dual);
+
+SEC("xdp")
+int xdp_keepalive_dual(struct xdp_md *ctx)
+{
+	// for border checking
+	void *data_start = (void *)(long)ctx->data;
+	void *data_end = (void *)(long)ctx->data_end;
+
+	// result
+	__u32 action = XDP_PASS;
+	__u32 reason = REASON_NOT_IP;
+
+	// current parsed header position pointer
+	void *dataptr = data_start;
+
+	if (debug_print) bpf_printk("New packet\n");
+	dump_header(data_start, data_end);
+
+	struct outer_headers outer = {};
+	int ret;
+
+	// gre netdevs hand over the IPv4 header right away, ip6gre ones put a
+	// pseudo Ethernet header in front of IPv6, whose MAC bytes can look like
+	// anything, an IPv4 version included. Without an entry from the loader
+	// (ip link), the EtherType and IPv6 version of ip6gre frames decide.
+	__u32 ifindex = ctx->ingress_ifindex;
+	__u32 *family = bpf_map_lookup_elem(&netdev_families, &ifindex);
+	bool ipv6 = family ? *family == TUNNEL_FAMILY_IPV6 : is_ip6gre_frame(dataptr, data_end);
+
+	if (ipv6) {
+		if (!is_ip6gre_frame(dataptr, data_end)) goto out;
+		dataptr += IP6GRE_HLEN; // skip to the IPv6 header
+		ret = parse_outer_ipv6(&dataptr, data_end, &outer);
+	} else {
+		if ((dataptr + 1) > data_end) goto out;
+		if ((((__u8 *)dataptr)[0] & 0xF0) != 0x40) goto out;
+		ret = parse_outer_ipv4(&dataptr, data_end, &outer);
+	}
+	if (ret < 0) {
+		reason = outer_ip_malformed_reason(ret);
+		goto malformed;
+	}
+	if (ret > 0) {
+		reason = REASON_NOT_GRE;
+		goto out;
+	}
+
+	reason = handle_outer_gre(&dataptr, data_end, &outer);
+	action = tunnel_verdict(ctx, &outer, &reason);
+	goto out;
+
+malformed:
+	action = malformed_action;
+
+out:
+	count_reason(reason);
+	return action;
+}
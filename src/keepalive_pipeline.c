@@ -0,0 +1,280 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#include <stddef.h>
+#include <stdbool.h>
+#include <linux/bpf.h>
+#include <linux/in.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/icmp.h>
+#include <linux/icmpv6.h>
+#include <linux/udp.h>
+#include <linux/tcp.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+#include "underlay.h"
+
+char _license[4] SEC("license") = "GPL";
+
+// The underlay program cut into stages chained with tail calls, each one
+// verified on its own: the L2 stage (the entry point), one stage per outer
+// IP family, the outer GRE stage and one keepalive matcher per inner family.
+// A stage can be swapped at runtime by writing another program into its
+// pipeline_stages slot. Answers the same as keepalive_underlay.o.
+//
+// Packet pointers do not survive a tail call, so what a stage found is
+// handed on as offsets into the frame in a per-CPU scratch entry; the next
+// stage runs on the same CPU before any other packet.
+//
+// There is no libxdp run configuration: whether a program the dispatcher
+// runs through freplace may tail call depends on the kernel.
+
+// what the stages found so far, offsets from the start of the frame
+struct pipeline_state {
+	__u16 l3_off;         // outer IP header
+	__u16 gre_off;        // outer GRE header
+	__u16 cutoff_off;     // inner packet
+	__u8 vlans;
+	__u8 ipv6;            // the outer header is IPv6
+	struct gre_info gre;  // outer GRE header
+	__be16 inner_proto;
+};
+
+// keeps offsets read back from the map within what the verifier accepts
+// for variable packet offsets, far beyond any XDP frame
+#define PIPELINE_OFF_MASK 0x3fff
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, __u32);
+	__type(value, struct pipeline_state);
+	__uint(max_entries, 1);
+} pipeline_scratch SEC(".maps");
+
+int stage_outer_ipv4(struct xdp_md *ctx);
+int stage_outer_ipv6(struct xdp_md *ctx);
+int stage_gre(struct xdp_md *ctx);
+int stage_match_ipv4(struct xdp_md *ctx);
+int stage_match_ipv6(struct xdp_md *ctx);
+
+// filled by libbpf at load time, see enum pipeline_stage
+struct {
+	__uint(type, BPF_MAP_TYPE_PROG_ARRAY);
+	__uint(max_entries, STAGE_MAX);
+	__uint(key_size, sizeof(__u32));
+	__array(values, int (struct xdp_md *));
+} pipeline_stages SEC(".maps") = {
+	.values = {
+		[STAGE_OUTER_IPV4] = (void *)&stage_outer_ipv4,
+		[STAGE_OUTER_IPV6] = (void *)&stage_outer_ipv6,
+		[STAGE_GRE] = (void *)&stage_gre,
+		[STAGE_MATCH_IPV4] = (void *)&stage_match_ipv4,
+		[STAGE_MATCH_IPV6] = (void *)&stage_match_ipv6,
+	},
+};
+
+static __always_inline struct pipeline_state *get_state(void) {
+	__u32 zero = 0;
+	return bpf_map_lookup_elem(&pipeline_scratch, &zero);
+}
+
+static __always_inline void *frame_at(struct xdp_md *ctx, __u16 off) {
+	return (void *)(long)ctx->data + (off & PIPELINE_OFF_MASK);
+}
+
+// The outer headers as the earlier stages found them, false if the frame no
+// longer holds the outer IP header.
+static __always_inline bool load_outer(struct xdp_md *ctx, struct pipeline_state *st, struct outer_headers *outer) {
+	void *data_end = (void *)(long)ctx->data_end;
+	void *pos = frame_at(ctx, st->l3_off);
+
+	if (st->ipv6) {
+		if (pos + sizeof(struct ipv6hdr) > data_end) return false;
+		outer->ipv6hdr = pos;
+	} else {
+		if (pos + sizeof(struct iphdr) > data_end) return false;
+		outer->iphdr = pos;
+	}
+	outer->gre = st->gre;
+	outer->inner_proto = st->inner_proto;
+	outer->cutoff_pos = frame_at(ctx, st->cutoff_off);
+	return true;
+}
+
+// L2 stage, the program attached to the NIC
+SEC("xdp")
+int xdp_keepalive_pipeline(struct xdp_md *ctx)
+{
+	// for border checking
+	void *data_start = (void *)(long)ctx->data;
+	void *data_end = (void *)(long)ctx->data_end;
+
+	// result
+	__u32 action = XDP_PASS;
+	__u32 reason = REASON_NOT_IP;
+
+	// current parsed header position pointer
+	void *dataptr = data_start;
+
+	if (debug_print) bpf_printk("New packet\n");
+	dump_header(data_start, data_end);
+
+	__be16 proto;
+	int vlans = parse_l2(&dataptr, data_end, &proto);
+	if (vlans < 0) goto out;
+
+	struct pipeline_state *st = get_state();
+	if (!st) {
+		reason = REASON_STAGE_FAILED;
+		goto out;
+	}
+	__builtin_memset(st, 0, sizeof(*st));
+	st->vlans = vlans;
+	st->l3_off = dataptr - data_start;
+
+	if (proto == bpf_htons(ETH_P_IP)) {
+		bpf_tail_call(ctx, &pipeline_stages, STAGE_OUTER_IPV4);
+	} else if (proto == bpf_htons(ETH_P_IPV6)) {
+		st->ipv6 = 1;
+		bpf_tail_call(ctx, &pipeline_stages, STAGE_OUTER_IPV6);
+	} else {
+		goto out;
+	}
+	reason = REASON_STAGE_FAILED;
+
+out:
+	count_reason(reason);
+	return action;
+}
+
+// Outer IP stages, one per family so each is verified for its own header
+// layout only.
+static __always_inline int outer_ip_stage(struct xdp_md *ctx, bool ipv6) {
+	void *data_start = (void *)(long)ctx->data;
+	void *data_end = (void *)(long)ctx->data_end;
+	__u32 action = XDP_PASS;
+	__u32 reason = REASON_STAGE_FAILED;
+	struct outer_headers outer = {};
+	int ret;
+
+	struct pipeline_state *st = get_state();
+	if (!st) goto out;
+	void *dataptr = frame_at(ctx, st->l3_off);
+
+	if (ipv6) ret = parse_outer_ipv6(&dataptr, data_end, &outer);
+	else ret = parse_outer_ipv4(&dataptr, data_end, &outer);
+	if (ret < 0) {
+		reason = outer_ip_malformed_reason(ret);
+		action = malformed_action;
+		goto out;
+	}
+	if (ret > 0) {
+		reason = REASON_NOT_GRE;
+		goto out;
+	}
+
+	st->gre_off = dataptr - data_start;
+	bpf_tail_call(ctx, &pipeline_stages, STAGE_GRE);
+
+out:
+	count_reason(reason);
+	return action;
+}
+
+SEC("xdp")
+int stage_outer_ipv4(struct xdp_md *ctx)
+{
+	return outer_ip_stage(ctx, false);
+}
+
+SEC("xdp")
+int stage_outer_ipv6(struct xdp_md *ctx)
+{
+	return outer_ip_stage(ctx, true);
+}
+
+// Outer GRE stage: the tunnel lookup, replies to our keepalives and the
+// inner Ethernet header of L2 tunnels, then on to the matcher of the inner
+// family.
+SEC("xdp")
+int stage_gre(struct xdp_md *ctx)
+{
+	void *data_start = (void *)(long)ctx->data;
+	void *data_end = (void *)(long)ctx->data_end;
+	__u32 action = XDP_PASS;
+	__u32 reason = REASON_STAGE_FAILED;
+	struct outer_headers outer = {};
+	int ret;
+
+	struct pipeline_state *st = get_state();
+	if (!st || !load_outer(ctx, st, &outer)) goto out;
+	void *dataptr = frame_at(ctx, st->gre_off);
+
+	reason = parse_underlay_gre(&dataptr, data_end, &outer);
+	if (reason != REASON_REFLECTED) {
+		if (reason == REASON_KEEPALIVE_REPLY && xsk_replies) {
+			ret = xsk_reply_verdict(ctx, &outer);
+			if (ret >= 0) {
+				action = ret;
+				goto out;
+			}
+		}
+		action = underlay_verdict(ctx, &outer, st->vlans, &reason);
+		goto out;
+	}
+
+	st->gre = outer.gre;
+	st->inner_proto = outer.inner_proto;
+	st->cutoff_off = outer.cutoff_pos - data_start;
+
+	// a keepalive is of the outer family, the matcher checks that
+	if (outer.inner_proto == bpf_htons(ETH_P_IP)) {
+		bpf_tail_call(ctx, &pipeline_stages, STAGE_MATCH_IPV4);
+	} else if (outer.inner_proto == bpf_htons(ETH_P_IPV6)) {
+		bpf_tail_call(ctx, &pipeline_stages, STAGE_MATCH_IPV6);
+	} else {
+		if (debug_print) bpf_printk("Unknown proto %x inside GRE", outer.inner_proto);
+		reason = REASON_UNKNOWN_PROTO;
+		goto out;
+	}
+	reason = REASON_STAGE_FAILED;
+
+out:
+	count_reason(reason);
+	return action;
+}
+
+// Keepalive matchers, one per inner family: the inner headers, the per-peer
+// checks and the reflected frame.
+static __always_inline int match_stage(struct xdp_md *ctx, bool ipv6) {
+	void *data_end = (void *)(long)ctx->data_end;
+	__u32 action = XDP_PASS;
+	__u32 reason = REASON_STAGE_FAILED;
+	struct outer_headers outer = {};
+
+	struct pipeline_state *st = get_state();
+	if (!st || !load_outer(ctx, st, &outer)) goto out;
+	void *dataptr = outer.cutoff_pos;
+
+	if (ipv6) reason = match_ipv6_keepalive(&dataptr, data_end, &outer);
+	else reason = match_ipv4_keepalive(&dataptr, data_end, &outer);
+	if (reason == REASON_REFLECTED) reason = check_keepalive_peer(&outer);
+	action = underlay_verdict(ctx, &outer, st->vlans, &reason);
+
+out:
+	count_reason(reason);
+	return action;
+}
+
+SEC("xdp")
+int stage_match_ipv4(struct xdp_md *ctx)
+{
+	return match_stage(ctx, false);
+}
+
+SEC("xdp")
+int stage_match_ipv6(struct xdp_md *ctx)
+{
+	return match_stage(ctx, true);
+}
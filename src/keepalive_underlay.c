@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#include <stddef.h>
+#include <stdbool.h>
+#include <linux/bpf.h>
+#include <linux/in.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/icmp.h>
+#include <linux/icmpv6.h>
+#include <linux/udp.h>
+#include <linux/tcp.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+#include "underlay.h"
+
+char _license[4] SEC("license") = "GPL";
+
+// Attached to the physical (underlay) NIC instead of each tunnel interface,
+// so it can run in driver mode and answer keepalives of every configured
+// tunnel before the kernel allocates an sk_buff for them.
+
+struct {
+	__uint(priority, KEEPALIVE_RUN_PRIO);
+	__uint(XDP_PASS, 1);
+} XDP_RUN_CONFIG(xdp_keepalive_underlay);
+
+SEC("xdp")
+int xdp_keepalive_underlay(struct xdp_md *ctx)
+{
+	// for border checking
+	void *data_start = (void *)(long)ctx->data;
+	void *data_end = (void *)(long)ctx->data_end;
+
+	// result
+	__u32 action = XDP_PASS;
+	__u32 reason = REASON_NOT_IP;
+
+	// current parsed header position pointer
+	void *dataptr = data_start;
+
+	if (debug_print) bpf_printk("New packet\n");
+	dump_header(data_start, data_end);
+
+	// underlay frames start with a real Ethernet header
+	__be16 proto;
+	int vlans = parse_l2(&dataptr, data_end, &proto);
+	if (vlans < 0) goto out;
+
+	struct outer_headers outer = {};
+	int ret;
+
+	if (proto == bpf_htons(ETH_P_IP)) {
+		ret = parse_outer_ipv4(&dataptr, data_end, &outer);
+	} else if (proto == bpf_htons(ETH_P_IPV6)) {
+		ret = parse_outer_ipv6(&dataptr, data_end, &outer);
+	} else {
+		goto out;
+	}
+	if (ret < 0) {
+		reason = outer_ip_malformed_reason(ret);
+		action = malformed_action;
+		goto out;
+	}
+	if (ret > 0) {
+		reason = REASON_NOT_GRE;
+		goto out;
+	}
+
+	reason = parse_underlay_gre(&dataptr, data_end, &outer);
+	if (reason == REASON_REFLECTED) reason = match_inner_keepalive(&dataptr, data_end, &outer);
+	if (reason == REASON_KEEPALIVE_REPLY && xsk_replies) {
+		// the service records the replies arriving on its queue, the
+		// other queues are recorded here as without it
+		ret = xsk_reply_verdict(ctx, &outer);
+		if (ret >= 0) {
+			action = ret;
+			goto out;
+		}
+	}
+	action = underlay_verdict(ctx, &outer, vlans, &reason);
+
+out:
+	count_reason(reason);
+	return action;
+}
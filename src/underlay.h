@@ -0,0 +1,128 @@
+#pragma once
+#ifndef __UNDERLAY_H__
+#define __UNDERLAY_H__
+
+#include "common.h"
+
+// Shared by the programs attached to the physical (underlay) NIC, which see
+// real Ethernet frames and answer for the tunnels listed by userspace.
+
+// AF_XDP socket of the keepalive service per RX queue, see xsk_replies
+struct {
+	__uint(type, BPF_MAP_TYPE_XSKMAP);
+	__type(key, __u32);
+	__type(value, __u32);
+	__uint(max_entries, MAX_XSK_QUEUES);
+	__uint(pinning, LIBBPF_PIN_BY_NAME);
+} xsks_map SEC(".maps");
+
+// Ethernet header followed by as many tags as are looked through, a frame
+// may carry fewer of them
+struct l2_headers {
+	struct ethhdr eth;
+	struct vlan_hdr vlan[VLAN_MAX_DEPTH];
+};
+
+static __always_inline bool proto_is_vlan(__be16 proto) {
+	return proto == bpf_htons(ETH_P_8021Q) || proto == bpf_htons(ETH_P_8021AD);
+}
+
+// Ethernet header at *dataptr, on trunks followed by one or two VLAN tags.
+// Returns the number of tags, with *proto the EtherType behind them, or -1
+// if the frame is cut short. A frame with more tags than VLAN_MAX_DEPTH
+// returns a VLAN EtherType, which callers do not handle.
+static __always_inline int parse_l2(void **dataptr, void *data_end, __be16 *proto) {
+	void *pos = *dataptr;
+
+	if (pos + sizeof(struct ethhdr) > data_end) return -1;
+	*proto = ((struct ethhdr *)pos)->h_proto;
+	pos += sizeof(struct ethhdr);
+
+	int vlans = 0;
+	#pragma unroll
+	for (int i = 0; i < VLAN_MAX_DEPTH; ++i) {
+		if (!proto_is_vlan(*proto)) break;
+		if (pos + sizeof(struct vlan_hdr) > data_end) return -1;
+		*proto = ((struct vlan_hdr *)pos)->h_vlan_encapsulated_proto;
+		pos += sizeof(struct vlan_hdr);
+		vlans++;
+	}
+
+	*dataptr = pos;
+	return vlans;
+}
+
+// The outer GRE header of a tunnel listed in tunnel_endpoints. L2 tunnels
+// (gretap, ip6gretap) carry an Ethernet header in front of the inner
+// packet, which is stripped along with the outer ones. Returns as
+// parse_outer_gre().
+static __always_inline __u32 parse_underlay_gre(void **dataptr, void *data_end, struct outer_headers *outer) {
+	__u32 reason = parse_outer_gre(dataptr, data_end, outer, true);
+	if (reason != REASON_REFLECTED) return reason;
+
+	if (outer->gre.proto == bpf_htons(ETH_P_TEB)) {
+		if (*dataptr + sizeof(struct ethhdr) > data_end) return REASON_SHORT_INNER_IP;
+		outer->inner_proto = ((struct ethhdr *)*dataptr)->h_proto;
+		*dataptr += sizeof(struct ethhdr);
+		outer->cutoff_pos = *dataptr;
+	}
+	return REASON_REFLECTED;
+}
+
+// With xsk_replies, a keepalive reply goes to the service's socket on the
+// queue it arrived on, and the service records it. Returns the redirect
+// verdict, or -1 once a reply from a queue without a socket is recorded
+// here as without the service.
+static __always_inline int xsk_reply_verdict(struct xdp_md *ctx, struct outer_headers *outer) {
+	__u32 queue = ctx->rx_queue_index;
+
+	if (bpf_map_lookup_elem(&xsks_map, &queue)) return bpf_redirect_map(&xsks_map, queue, XDP_DROP);
+	record_liveness_outer(outer);
+	return -1;
+}
+
+// Verdict for the underlay NIC. The inner packet is already addressed to the
+// peer, so the reply is our Ethernet header with the MAC addresses swapped
+// and the same vlans tags, followed by the inner packet, whose family the
+// outer GRE protocol (or the inner Ethernet header of L2 tunnels) tells. May
+// change *reason if stripping fails.
+static __always_inline __u32 underlay_verdict(struct xdp_md *ctx, struct outer_headers *outer, int vlans, __u32 *reason) {
+	void *data_start = (void *)(long)ctx->data;
+	void *data_end = (void *)(long)ctx->data_end;
+
+	if (reason_is_malformed(*reason)) return malformed_action;
+	if (reason_is_dropped(*reason)) return XDP_DROP;
+	if (*reason != REASON_REFLECTED) return XDP_PASS;
+
+	if (data_start + sizeof(struct l2_headers) > data_end) {
+		*reason = REASON_SHORT_OUTER_IP;
+		return malformed_action;
+	}
+	struct l2_headers orig = *(struct l2_headers *)data_start;
+	int l2_len = sizeof(struct ethhdr) + vlans * sizeof(struct vlan_hdr);
+	if (bpf_xdp_adjust_head(ctx, (int)(outer->cutoff_pos - data_start) - l2_len)) {
+		*reason = REASON_ADJUST_HEAD_FAILED;
+		return malformed_action;
+	}
+	data_start = (void *)(long)ctx->data;
+	data_end = (void *)(long)ctx->data_end;
+	// the inner packet alone is longer than the headers with both tags
+	if (data_start + sizeof(struct l2_headers) > data_end) {
+		*reason = REASON_ADJUST_HEAD_FAILED;
+		return malformed_action;
+	}
+	struct l2_headers *l2 = (struct l2_headers *)data_start;
+	__builtin_memcpy(l2->eth.h_dest, orig.eth.h_source, ETH_ALEN);
+	__builtin_memcpy(l2->eth.h_source, orig.eth.h_dest, ETH_ALEN);
+	l2->eth.h_proto = vlans ? orig.eth.h_proto : outer->inner_proto;
+	#pragma unroll
+	for (int i = 0; i < VLAN_MAX_DEPTH; ++i) {
+		if (i >= vlans) break;
+		l2->vlan[i].h_vlan_TCI = orig.vlan[i].h_vlan_TCI;
+		l2->vlan[i].h_vlan_encapsulated_proto = i + 1 == vlans
+			? outer->inner_proto : orig.vlan[i].h_vlan_encapsulated_proto;
+	}
+	return XDP_TX;
+}
+
+#endif
@@ -0,0 +1,196 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <bpf/libbpf.h>
+#include "common_user.h"
+
+static const char *reason_names[REASON_MAX] = {
+	[REASON_NOT_IP] = "not-ip",
+	[REASON_NOT_GRE] = "not-gre",
+	[REASON_UNKNOWN_TUNNEL] = "unknown-tunnel",
+	[REASON_UNKNOWN_PROTO] = "unknown-proto",
+	[REASON_GRE_UNSUPPORTED] = "gre-unsupported",
+	[REASON_INNER_NOT_GRE] = "inner-not-gre",
+	[REASON_NOT_KEEPALIVE] = "not-keepalive",
+	[REASON_ADDR_MISMATCH] = "addr-mismatch",
+	[REASON_KEY_MISMATCH] = "key-mismatch",
+	[REASON_REFLECTED] = "reflected",
+	[REASON_KEEPALIVE_REPLY] = "keepalive-reply",
+	[REASON_NOT_ALLOWED] = "not-allowed",
+	[REASON_RATE_LIMITED] = "rate-limited",
+	[REASON_STAGE_FAILED] = "stage-failed",
+	[REASON_SHORT_OUTER_IP] = "short-outer-ip",
+	[REASON_SHORT_OUTER_GRE] = "short-outer-gre",
+	[REASON_SHORT_INNER_IP] = "short-inner-ip",
+	[REASON_SHORT_INNER_GRE] = "short-inner-gre",
+	[REASON_ADJUST_HEAD_FAILED] = "adjust-head-failed",
+	[REASON_BAD_OUTER_IP] = "bad-outer-ip",
+};
+
+struct bpf_object *xdp_object_open(const char *path)
+{
+	struct bpf_object *obj;
+	struct bpf_map *map;
+
+	// SEC("xdp") tells libbpf the program type
+	obj = bpf_object__open_file(path, NULL);
+	if (!obj) {
+		fprintf(stderr, "%s: open failed: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	// the maps are pinned by name for the daemon and libxdp, a tool loading
+	// its own copy must neither reuse nor leave behind pins
+	bpf_object__for_each_map(map, obj)
+		bpf_map__set_pin_path(map, NULL);
+	return obj;
+}
+
+int parse_xdp_action(const char *str)
+{
+	if (!strcmp(str, "pass"))
+		return XDP_PASS;
+	if (!strcmp(str, "drop"))
+		return XDP_DROP;
+	if (!strcmp(str, "abort"))
+		return XDP_ABORTED;
+	return -1;
+}
+
+const char *verdict_name(__u32 verdict)
+{
+	static char buf[32];
+
+	switch (verdict) {
+	case XDP_ABORTED: return "XDP_ABORTED";
+	case XDP_DROP: return "XDP_DROP";
+	case XDP_PASS: return "XDP_PASS";
+	case XDP_TX: return "XDP_TX";
+	case XDP_REDIRECT: return "XDP_REDIRECT";
+	}
+	snprintf(buf, sizeof(buf), "INVALID(%d)", (int)verdict);
+	return buf;
+}
+
+const char *reason_name(__u32 reason)
+{
+	if (reason >= REASON_MAX || !reason_names[reason])
+		return "unknown";
+	return reason_names[reason];
+}
+
+int parse_tunnel_endpoint(const char *local, const char *remote, struct tunnel_endpoint *ep)
+{
+	memset(ep, 0, sizeof(*ep));
+	if (inet_pton(AF_INET, local, ep->local) == 1 && inet_pton(AF_INET, remote, ep->remote) == 1) {
+		ep->family = TUNNEL_FAMILY_IPV4;
+		return 0;
+	}
+	if (inet_pton(AF_INET6, local, ep->local) == 1 && inet_pton(AF_INET6, remote, ep->remote) == 1) {
+		ep->family = TUNNEL_FAMILY_IPV6;
+		return 0;
+	}
+	return -EINVAL;
+}
+
+int read_tunnels_file(const char *path, struct tunnel_endpoint **endpoints, struct tunnel_inner **inners, int *count)
+{
+	char line[256], tok[6][INET6_ADDRSTRLEN];
+	struct tunnel_endpoint ep, inner_ep, *new_endpoints;
+	struct tunnel_inner inner, *new_inners;
+	unsigned int lineno = 0;
+	int err = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		err = -errno;
+		fprintf(stderr, "Cannot open %s: %s\n", path, strerror(-err));
+		return err;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		++lineno;
+		line[strcspn(line, "#")] = '\0';
+		int fields = sscanf(line, "%45s %45s %45s %45s %45s %45s", tok[0], tok[1], tok[2],
+				    tok[3], tok[4], tok[5]);
+		int i = 2;
+
+		if (fields < 2)
+			continue;
+		if (parse_tunnel_endpoint(tok[0], tok[1], &ep)) {
+			fprintf(stderr, "%s:%u: invalid address pair\n", path, lineno);
+			err = -EINVAL;
+			break;
+		}
+		if (fields > i && strcmp(tok[i], "inner")) {
+			if (parse_gre_key(tok[i], &ep.key)) {
+				fprintf(stderr, "%s:%u: invalid GRE key %s\n", path, lineno, tok[i]);
+				err = -EINVAL;
+				break;
+			}
+			ep.flags |= TUNNEL_F_KEY;
+			i++;
+		}
+		memset(&inner, 0, sizeof(inner));
+		if (fields > i) {
+			if (fields != i + 3 || strcmp(tok[i], "inner") || parse_tunnel_endpoint(tok[i + 1], tok[i + 2], &inner_ep)) {
+				fprintf(stderr, "%s:%u: expected \"inner LOCAL REMOTE\" after the tunnel\n", path, lineno);
+				err = -EINVAL;
+				break;
+			}
+			inner.family = inner_ep.family;
+			memcpy(inner.local, inner_ep.local, sizeof(inner.local));
+			memcpy(inner.remote, inner_ep.remote, sizeof(inner.remote));
+		}
+
+		new_endpoints = realloc(*endpoints, (*count + 1) * sizeof(**endpoints));
+		if (!new_endpoints) {
+			err = -ENOMEM;
+			break;
+		}
+		*endpoints = new_endpoints;
+		if (inners) {
+			new_inners = realloc(*inners, (*count + 1) * sizeof(**inners));
+			if (!new_inners) {
+				err = -ENOMEM;
+				break;
+			}
+			*inners = new_inners;
+			(*inners)[*count] = inner;
+		}
+		(*endpoints)[(*count)++] = ep;
+	}
+	fclose(f);
+	return err;
+}
+
+// "LOCAL REMOTE [key KEY]", the reverse of parse_tunnel_endpoint()
+void format_tunnel_endpoint(const struct tunnel_endpoint *ep, char *buf, size_t size)
+{
+	char local[INET6_ADDRSTRLEN], remote[INET6_ADDRSTRLEN];
+	int af = ep->family == TUNNEL_FAMILY_IPV4 ? AF_INET : AF_INET6;
+	int len;
+
+	inet_ntop(af, ep->local, local, sizeof(local));
+	inet_ntop(af, ep->remote, remote, sizeof(remote));
+	len = snprintf(buf, size, "%s %s", local, remote);
+	if (ep->flags & TUNNEL_F_KEY && len > 0 && (size_t)len < size)
+		snprintf(buf + len, size - len, " key %u", ntohl(ep->key));
+}
+
+int parse_gre_key(const char *str, __be32 *key)
+{
+	unsigned long val;
+	char *end;
+
+	if (inet_pton(AF_INET, str, key) == 1)
+		return 0;
+	errno = 0;
+	val = strtoul(str, &end, 0);
+	if (errno || *end || end == str || val > 0xffffffffUL)
+		return -EINVAL;
+	*key = htonl(val);
+	return 0;
+}
@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#pragma once
+#ifndef __COMMON_USER_H__
+#define __COMMON_USER_H__
+
+#include <linux/types.h>
+#include <bpf/libbpf.h>
+#include "../src/common_kern_user.h"
+
+// open an object built from src/ by path, for tools that take any of them
+struct bpf_object *xdp_object_open(const char *path);
+
+// XDP verdict for malformed packets: "pass", "drop" or "abort", -1 if unknown
+int parse_xdp_action(const char *str);
+
+// "XDP_TX" and so on, or "INVALID(n)"
+const char *verdict_name(__u32 verdict);
+
+const char *reason_name(__u32 reason);
+
+// fill ep from textual addresses, both must be of the same family
+int parse_tunnel_endpoint(const char *local, const char *remote, struct tunnel_endpoint *ep);
+
+// tunnels file: one "LOCAL REMOTE [KEY] [inner INNER_LOCAL INNER_REMOTE]"
+// tunnel per line, # starts a comment. The tunnels are appended to
+// *endpoints and, unless inners is NULL, their inner addresses to *inners,
+// both grown with realloc(). On error they hold what was read so far, for
+// the caller to free.
+int read_tunnels_file(const char *path, struct tunnel_endpoint **endpoints, struct tunnel_inner **inners, int *count);
+
+// buf should hold at least TUNNEL_ENDPOINT_STRLEN bytes
+#define TUNNEL_ENDPOINT_STRLEN 112
+void format_tunnel_endpoint(const struct tunnel_endpoint *ep, char *buf, size_t size);
+
+// GRE key as a number or in dotted-quad notation, like ip-tunnel(8) takes it
+int parse_gre_key(const char *str, __be32 *key);
+
+#endif
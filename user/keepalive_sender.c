@@ -0,0 +1,300 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+// A keepalive is the packet the peer has to send back to us, wrapped in the
+// tunnel encapsulation: the peer decapsulates it as it would any tunnelled
+// packet and routes the inner packet, which is addressed to us. What comes
+// back is the bare inner GRE header with protocol 0, which the XDP programs
+// recognise as a reply and record in their tunnel_liveness map.
+//
+//   IPv4 tunnel: IPv4 local->remote | GRE 0x0800 | IPv4 remote->local | GRE 0
+//   IPv6 tunnel: IPv6 local->remote | GRE 0x86dd | IPv6 remote->local | GRE 0
+//
+// IPv4 keepalives go out through an IPPROTO_RAW socket carrying the whole
+// packet. IPv6 has no header-including raw socket for GRE, so the kernel
+// builds the outer header and the source address is passed as IPV6_PKTINFO.
+#define _GNU_SOURCE // sendmmsg(), struct in6_pktinfo
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#include "keepalive_sender.h"
+
+// sendmmsg() takes at most UIO_MAXIOV messages per call
+#define KEEPALIVE_BATCH 1024
+
+#define GRE_FLAG_KEY 0x2000
+
+struct keepalive_packet {
+	union {
+		struct sockaddr_in in;
+		struct sockaddr_in6 in6;
+	} dst;
+	union {
+		char buf[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov;
+	__u8 data[KEEPALIVE_PACKET_MAX];
+};
+
+struct keepalive_sender {
+	int fd4, fd6;
+	int count4, count6;
+	struct keepalive_packet *packets;
+	// IPv4 tunnels first, then IPv6 ones, each a contiguous batch
+	struct mmsghdr *msgs;
+	// the current round: next message to send and how many went out
+	int next, sent;
+};
+
+static __u16 ipv4_csum(const void *hdr, int len)
+{
+	const __u16 *p = hdr;
+	__u32 sum = 0;
+
+	for (int i = 0; i < len / 2; ++i)
+		sum += p[i];
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+static int put_gre(__u8 *p, __u16 proto, const struct tunnel_endpoint *ep)
+{
+	__be16 *gre = (__be16 *)p;
+
+	gre[0] = htons(ep->flags & TUNNEL_F_KEY ? GRE_FLAG_KEY : 0);
+	gre[1] = htons(proto);
+	if (!(ep->flags & TUNNEL_F_KEY))
+		return 4;
+	memcpy(p + 4, &ep->key, 4);
+	return 8;
+}
+
+static int put_ipv4(__u8 *p, const __be32 *saddr, const __be32 *daddr, int payload_len)
+{
+	struct iphdr *iph = (struct iphdr *)p;
+
+	memset(iph, 0, sizeof(*iph));
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->ttl = 255;
+	iph->protocol = IPPROTO_GRE;
+	iph->tot_len = htons(sizeof(*iph) + payload_len);
+	iph->saddr = *saddr;
+	iph->daddr = *daddr;
+	iph->check = ipv4_csum(iph, sizeof(*iph));
+	return sizeof(*iph);
+}
+
+static int put_ipv6(__u8 *p, const __be32 *saddr, const __be32 *daddr, int payload_len)
+{
+	struct ipv6hdr *ip6h = (struct ipv6hdr *)p;
+
+	memset(ip6h, 0, sizeof(*ip6h));
+	ip6h->version = 6;
+	ip6h->nexthdr = IPPROTO_GRE;
+	ip6h->hop_limit = 255;
+	ip6h->payload_len = htons(payload_len);
+	memcpy(&ip6h->saddr, saddr, sizeof(ip6h->saddr));
+	memcpy(&ip6h->daddr, daddr, sizeof(ip6h->daddr));
+	return sizeof(*ip6h);
+}
+
+static int build_ipv4(struct keepalive_packet *pkt, const struct tunnel_endpoint *ep)
+{
+	pkt->dst.in.sin_family = AF_INET;
+	pkt->dst.in.sin_addr.s_addr = ep->remote[0];
+	return keepalive_build_packet(pkt->data, ep);
+}
+
+static int build_ipv6(struct keepalive_packet *pkt, const struct tunnel_endpoint *ep, struct msghdr *msg)
+{
+	int gre_len = ep->flags & TUNNEL_F_KEY ? 8 : 4;
+	struct in6_pktinfo *pktinfo;
+	struct cmsghdr *cmsg;
+	__u8 *p = pkt->data;
+
+	p += put_gre(p, ETH_P_IPV6, ep);
+	p += put_ipv6(p, ep->remote, ep->local, gre_len);
+	p += put_gre(p, 0, ep);
+
+	pkt->dst.in6.sin6_family = AF_INET6;
+	memcpy(&pkt->dst.in6.sin6_addr, ep->remote, sizeof(pkt->dst.in6.sin6_addr));
+
+	// send from the tunnel's local address, not whatever the route prefers
+	msg->msg_control = pkt->control.buf;
+	msg->msg_controllen = sizeof(pkt->control.buf);
+	cmsg = CMSG_FIRSTHDR(msg);
+	cmsg->cmsg_level = IPPROTO_IPV6;
+	cmsg->cmsg_type = IPV6_PKTINFO;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(*pktinfo));
+	pktinfo = (struct in6_pktinfo *)CMSG_DATA(cmsg);
+	memset(pktinfo, 0, sizeof(*pktinfo));
+	memcpy(&pktinfo->ipi6_addr, ep->local, sizeof(pktinfo->ipi6_addr));
+	return p - pkt->data;
+}
+
+int keepalive_build_packet(__u8 *buf, const struct tunnel_endpoint *ep)
+{
+	int gre_len = ep->flags & TUNNEL_F_KEY ? 8 : 4;
+	__u8 *p = buf;
+
+	if (ep->family == TUNNEL_FAMILY_IPV4) {
+		p += put_ipv4(p, ep->local, ep->remote, gre_len + sizeof(struct iphdr) + gre_len);
+		p += put_gre(p, ETH_P_IP, ep);
+		p += put_ipv4(p, ep->remote, ep->local, gre_len);
+	} else {
+		p += put_ipv6(p, ep->local, ep->remote, gre_len + sizeof(struct ipv6hdr) + gre_len);
+		p += put_gre(p, ETH_P_IPV6, ep);
+		p += put_ipv6(p, ep->remote, ep->local, gre_len);
+	}
+	p += put_gre(p, 0, ep);
+	return p - buf;
+}
+
+static int open_ipv6_socket(void)
+{
+	// a raw GRE socket also gets a copy of every GRE packet received,
+	// which we have no use for
+	struct sock_filter drop_all = BPF_STMT(BPF_RET | BPF_K, 0);
+	struct sock_fprog prog = { .len = 1, .filter = &drop_all };
+	int hops = 255;
+	int fd;
+
+	fd = socket(AF_INET6, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_GRE);
+	if (fd < 0)
+		return -1;
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog))
+	    || setsockopt(fd, IPPROTO_IPV6, IPV6_UNICAST_HOPS, &hops, sizeof(hops))) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+struct keepalive_sender *keepalive_sender_new(const struct tunnel_endpoint *eps, int count)
+{
+	struct keepalive_sender *s;
+	int i4 = 0, i6 = 0;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	s->fd4 = s->fd6 = -1;
+	for (int i = 0; i < count; ++i) {
+		if (eps[i].family == TUNNEL_FAMILY_IPV4)
+			s->count4++;
+		else
+			s->count6++;
+	}
+
+	s->packets = calloc(count, sizeof(*s->packets));
+	s->msgs = calloc(count, sizeof(*s->msgs));
+	if (count && (!s->packets || !s->msgs))
+		goto err;
+
+	if (s->count4) {
+		s->fd4 = socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_RAW);
+		if (s->fd4 < 0) {
+			fprintf(stderr, "Cannot open IPv4 raw socket: %s\n", strerror(errno));
+			goto err;
+		}
+	}
+	if (s->count6) {
+		s->fd6 = open_ipv6_socket();
+		if (s->fd6 < 0) {
+			fprintf(stderr, "Cannot open IPv6 raw socket: %s\n", strerror(errno));
+			goto err;
+		}
+	}
+
+	for (int i = 0; i < count; ++i) {
+		bool ipv4 = eps[i].family == TUNNEL_FAMILY_IPV4;
+		int slot = ipv4 ? i4++ : s->count4 + i6++;
+		struct keepalive_packet *pkt = &s->packets[slot];
+		struct msghdr *msg = &s->msgs[slot].msg_hdr;
+
+		pkt->iov.iov_base = pkt->data;
+		pkt->iov.iov_len = ipv4 ? build_ipv4(pkt, &eps[i]) : build_ipv6(pkt, &eps[i], msg);
+		msg->msg_name = &pkt->dst;
+		msg->msg_namelen = ipv4 ? sizeof(pkt->dst.in) : sizeof(pkt->dst.in6);
+		msg->msg_iov = &pkt->iov;
+		msg->msg_iovlen = 1;
+	}
+	// no round in progress
+	s->next = count;
+	return s;
+
+err:
+	keepalive_sender_free(s);
+	return NULL;
+}
+
+// Sends the messages from s->next up to end through fd. A full socket buffer
+// stops it with -EAGAIN, to go on from the same message later; one message
+// that cannot be sent (no route, ...) must not hold back the rest.
+static int send_until(struct keepalive_sender *s, int fd, int end)
+{
+	while (s->next < end) {
+		int batch = end - s->next < KEEPALIVE_BATCH ? end - s->next : KEEPALIVE_BATCH;
+		int ret = sendmmsg(fd, s->msgs + s->next, batch, MSG_DONTWAIT);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return -EAGAIN;
+			// skip the message that failed
+			ret = 0;
+			s->next++;
+		}
+		s->sent += ret;
+		s->next += ret;
+	}
+	return 0;
+}
+
+int keepalive_sender_resume(struct keepalive_sender *s)
+{
+	if (send_until(s, s->fd4, s->count4) || send_until(s, s->fd6, s->count4 + s->count6))
+		return -EAGAIN;
+	return s->sent;
+}
+
+int keepalive_sender_send(struct keepalive_sender *s)
+{
+	s->next = 0;
+	s->sent = 0;
+	return keepalive_sender_resume(s);
+}
+
+int keepalive_sender_fd(struct keepalive_sender *s)
+{
+	if (s->next < s->count4)
+		return s->fd4;
+	if (s->next < s->count4 + s->count6)
+		return s->fd6;
+	return -1;
+}
+
+void keepalive_sender_free(struct keepalive_sender *s)
+{
+	if (!s)
+		return;
+	if (s->fd4 >= 0)
+		close(s->fd4);
+	if (s->fd6 >= 0)
+		close(s->fd6);
+	free(s->packets);
+	free(s->msgs);
+	free(s);
+}
@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#pragma once
+#ifndef __KEEPALIVE_SENDER_H__
+#define __KEEPALIVE_SENDER_H__
+
+#include <linux/types.h>
+#include "../src/common_kern_user.h"
+
+// Originates GRE keepalives for a set of tunnels. The packets are built once
+// and every round sends all of them with sendmmsg(), so thousands of tunnels
+// cost a handful of system calls per interval instead of a timer each.
+struct keepalive_sender;
+
+struct keepalive_sender *keepalive_sender_new(const struct tunnel_endpoint *eps, int count);
+
+// Start a round that sends one keepalive to every tunnel, dropping what is
+// left of the previous one. Returns how many were sent once the round is
+// complete, or -EAGAIN if a socket buffer filled up: the round then goes on
+// with keepalive_sender_resume() once keepalive_sender_fd() polls POLLOUT.
+int keepalive_sender_send(struct keepalive_sender *s);
+
+int keepalive_sender_resume(struct keepalive_sender *s);
+
+// socket the current round waits for, -1 once it is complete
+int keepalive_sender_fd(struct keepalive_sender *s);
+
+void keepalive_sender_free(struct keepalive_sender *s);
+
+// outer IPv6 header + GRE with key + inner IPv6 header + GRE with key
+#define KEEPALIVE_PACKET_MAX 96
+
+// The whole keepalive for ep from the outer IP header on, for senders that
+// bring their own link layer. Returns its length.
+int keepalive_build_packet(__u8 *buf, const struct tunnel_endpoint *ep);
+
+#endif
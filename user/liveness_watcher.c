@@ -0,0 +1,171 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+// A tunnel is down once liveness_timeout_ns passed without a keepalive. The
+// programs compare against the same timeout to decide whether a keepalive
+// brings a tunnel back up, so both sides agree on the state without sharing
+// anything but the clock: bpf_ktime_get_ns() is CLOCK_MONOTONIC.
+//
+// The scan reports a tunnel down when its deadline (last_seen + timeout)
+// falls between the previous scan and this one. That is exactly once per
+// outage without keeping per-tunnel state here, however late a scan runs.
+// The first scan has no previous one and takes every deadline since the
+// epoch of the clock: the timestamps in tunnel_liveness, which survive a
+// restart in the pinned map, tell which tunnels went down meanwhile.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include "common_user.h"
+#include "liveness_watcher.h"
+
+#define MAX_WATCHED_OBJECTS 8
+// tunnels read per bpf_map_lookup_batch() call
+#define SCAN_BATCH 1024
+
+struct liveness_watcher {
+	__u64 timeout_ns;
+	// 0 until the first scan
+	__u64 last_scan;
+	struct ring_buffer *rb;
+	int map_fds[MAX_WATCHED_OBJECTS];
+	int nr_maps;
+	struct tunnel_endpoint keys[SCAN_BATCH];
+	struct liveness_info values[SCAN_BATCH];
+};
+
+static __u64 monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void liveness_report(const struct tunnel_endpoint *ep, __u32 state)
+{
+	char buf[TUNNEL_ENDPOINT_STRLEN];
+
+	format_tunnel_endpoint(ep, buf, sizeof(buf));
+	printf("tunnel %s %s\n", buf, state == TUNNEL_UP ? "up" : "down");
+}
+
+static int handle_event(void *ctx, void *data, size_t size)
+{
+	const struct liveness_event *event = data;
+
+	if (size < sizeof(*event))
+		return 0;
+	liveness_report(&event->endpoint, event->state);
+	return 0;
+}
+
+struct liveness_watcher *liveness_watcher_new(__u64 timeout_ns)
+{
+	struct liveness_watcher *w = calloc(1, sizeof(*w));
+
+	if (!w)
+		return NULL;
+	w->timeout_ns = timeout_ns;
+	return w;
+}
+
+int liveness_watcher_add(struct liveness_watcher *w, struct bpf_object *obj)
+{
+	int map_fd = bpf_object__find_map_fd_by_name(obj, "tunnel_liveness");
+	int rb_fd = bpf_object__find_map_fd_by_name(obj, "liveness_events");
+	int err;
+
+	if (map_fd < 0 || rb_fd < 0)
+		return 0;
+	if (w->nr_maps == MAX_WATCHED_OBJECTS)
+		return -E2BIG;
+
+	if (!w->rb) {
+		w->rb = ring_buffer__new(rb_fd, handle_event, w, NULL);
+		err = w->rb ? 0 : -errno;
+	} else {
+		err = ring_buffer__add(w->rb, rb_fd, handle_event, w);
+	}
+	if (err) {
+		fprintf(stderr, "Cannot watch %s: %s\n", bpf_object__name(obj), strerror(-err));
+		return err;
+	}
+	w->map_fds[w->nr_maps++] = map_fd;
+	return 0;
+}
+
+int liveness_watcher_fd(struct liveness_watcher *w)
+{
+	return w->rb ? ring_buffer__epoll_fd(w->rb) : -1;
+}
+
+int liveness_watcher_poll(struct liveness_watcher *w)
+{
+	return w->rb ? ring_buffer__consume(w->rb) : 0;
+}
+
+static void check_deadline(struct liveness_watcher *w, const struct tunnel_endpoint *ep,
+			   const struct liveness_info *info, __u64 now)
+{
+	__u64 deadline = info->last_seen + w->timeout_ns;
+
+	if (deadline > w->last_scan && deadline <= now)
+		liveness_report(ep, TUNNEL_DOWN);
+}
+
+// one lookup per tunnel, for kernels without batch operations
+static void scan_each(struct liveness_watcher *w, int map_fd, __u64 now)
+{
+	struct tunnel_endpoint key, next;
+	struct liveness_info info;
+	void *prev = NULL;
+
+	while (!bpf_map_get_next_key(map_fd, prev, &next)) {
+		key = next;
+		prev = &key;
+		if (!bpf_map_lookup_elem(map_fd, &key, &info))
+			check_deadline(w, &key, &info, now);
+	}
+}
+
+// SCAN_BATCH tunnels per system call, ENOENT marks the last batch
+static void scan_map(struct liveness_watcher *w, int map_fd, __u64 now)
+{
+	__u32 batch, count;
+	void *in = NULL;
+	int err;
+
+	do {
+		count = SCAN_BATCH;
+		err = bpf_map_lookup_batch(map_fd, in, &batch, w->keys, w->values, &count, NULL);
+		if (err && errno != ENOENT) {
+			if (!in)
+				scan_each(w, map_fd, now);
+			else
+				fprintf(stderr, "Cannot read tunnel_liveness: %s\n", strerror(errno));
+			return;
+		}
+		for (__u32 i = 0; i < count; ++i)
+			check_deadline(w, &w->keys[i], &w->values[i], now);
+		in = &batch;
+	} while (!err);
+}
+
+void liveness_watcher_scan(struct liveness_watcher *w)
+{
+	__u64 now = monotonic_ns();
+
+	for (int i = 0; i < w->nr_maps; ++i)
+		scan_map(w, w->map_fds[i], now);
+	w->last_scan = now;
+}
+
+void liveness_watcher_free(struct liveness_watcher *w)
+{
+	if (!w)
+		return;
+	ring_buffer__free(w->rb);
+	free(w);
+}
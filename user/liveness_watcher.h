@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#pragma once
+#ifndef __LIVENESS_WATCHER_H__
+#define __LIVENESS_WATCHER_H__
+
+#include <linux/types.h>
+#include <bpf/libbpf.h>
+#include "../src/common_kern_user.h"
+
+// Reports tunnels going up and down. The programs push an event through
+// their liveness_events ring buffer when a tunnel comes up; going down is
+// the absence of packets, which only a periodic look at last_seen can tell.
+struct liveness_watcher;
+
+struct liveness_watcher *liveness_watcher_new(__u64 timeout_ns);
+
+// watch the tunnel_liveness map and liveness_events ring buffer of a loaded object
+int liveness_watcher_add(struct liveness_watcher *w, struct bpf_object *obj);
+
+// readable when ring buffer events are pending, -1 before the first object
+int liveness_watcher_fd(struct liveness_watcher *w);
+
+// report pending up events
+int liveness_watcher_poll(struct liveness_watcher *w);
+
+// report tunnels whose timeout expired since the last scan, or before the
+// first scan for the tunnels already in the map
+void liveness_watcher_scan(struct liveness_watcher *w);
+
+void liveness_watcher_free(struct liveness_watcher *w);
+
+// print a state change, for whoever else learns about one
+void liveness_report(const struct tunnel_endpoint *ep, __u32 state);
+
+#endif
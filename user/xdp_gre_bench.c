@@ -0,0 +1,759 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+// Micro-benchmark for the keepalive XDP programs.
+//
+// Every program found in the given objects is run through BPF_PROG_TEST_RUN
+// against a set of crafted frames. No NIC and no network is involved, the
+// kernel runs the program on a copy of the frame and reports the verdict and
+// the average run time. A suite can name another program it is compared
+// with case by case once everything ran, see keepalive_pipeline.o.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <getopt.h>
+#include <linux/types.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <arpa/inet.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include "common_user.h"
+
+#define FRAME_MAX 256
+#define DEFAULT_REPEAT 1000000
+
+struct frame {
+	__u8 data[FRAME_MAX];
+	__u32 len;
+};
+
+struct bench_case {
+	const char *name;
+	void (*build)(struct frame *f);
+};
+
+struct bench_suite {
+	const char *prog_name;
+	const struct bench_case *cases;
+	// prepares the maps of the loaded object, optional
+	int (*setup)(struct bpf_object *obj);
+	// program whose run time of the same cases this one is compared with
+	const char *compare_with;
+};
+
+// run time of every case, for the comparisons
+#define MAX_RESULTS 256
+
+struct bench_result {
+	const char *prog_name;
+	const char *case_name;
+	double ns;
+};
+
+static struct bench_result results[MAX_RESULTS];
+static int nr_results;
+
+// tunnel endpoints used in every crafted frame, "local" is us
+#define LOCAL4 "192.0.2.1"
+#define REMOTE4 "192.0.2.2"
+#define LOCAL6 "2001:db8::1"
+#define REMOTE6 "2001:db8::2"
+// inner IPv6 addresses of the IPv4 tunnel, for its cross-family keepalives
+#define INNER6_LOCAL "2001:db8:100::1"
+#define INNER6_REMOTE "2001:db8:100::2"
+
+static void *push(struct frame *f, __u32 len)
+{
+	void *p = f->data + f->len;
+
+	if (f->len + len > FRAME_MAX) {
+		fprintf(stderr, "frame too large\n");
+		exit(1);
+	}
+	memset(p, 0, len);
+	f->len += len;
+	return p;
+}
+
+static __u16 ipv4_csum(const void *hdr, int len)
+{
+	const __u16 *p = hdr;
+	__u32 sum = 0;
+
+	for (int i = 0; i < len / 2; ++i)
+		sum += p[i];
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+static struct iphdr *push_ipv4(struct frame *f, const char *saddr, const char *daddr, __u8 proto)
+{
+	struct iphdr *iph = push(f, sizeof(*iph));
+
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->ttl = 255;
+	iph->protocol = proto;
+	inet_pton(AF_INET, saddr, &iph->saddr);
+	inet_pton(AF_INET, daddr, &iph->daddr);
+	return iph;
+}
+
+// fill in the length and checksum once everything behind the header is pushed
+static void finish_ipv4(struct frame *f, struct iphdr *iph)
+{
+	iph->tot_len = htons(f->len - ((__u8 *)iph - f->data));
+	iph->check = 0;
+	iph->check = ipv4_csum(iph, iph->ihl * 4);
+}
+
+// router alert, right after push_ipv4()
+static void push_ipv4_ra(struct frame *f, struct iphdr *iph)
+{
+	__u8 *opt = push(f, 4);
+
+	opt[0] = 0x94;
+	opt[1] = 4;
+	iph->ihl += 1;
+}
+
+static struct ipv6hdr *push_ipv6(struct frame *f, const char *saddr, const char *daddr, __u8 nexthdr)
+{
+	struct ipv6hdr *ip6h = push(f, sizeof(*ip6h));
+
+	ip6h->version = 6;
+	ip6h->nexthdr = nexthdr;
+	ip6h->hop_limit = 255;
+	inet_pton(AF_INET6, saddr, &ip6h->saddr);
+	inet_pton(AF_INET6, daddr, &ip6h->daddr);
+	return ip6h;
+}
+
+static void finish_ipv6(struct frame *f, struct ipv6hdr *ip6h)
+{
+	ip6h->payload_len = htons(f->len - ((__u8 *)ip6h - f->data) - sizeof(*ip6h));
+}
+
+// empty hop-by-hop, destination or routing options header: PadN to 8 bytes
+static void push_ipv6_opts(struct frame *f, __u8 nexthdr)
+{
+	__u8 *opt = push(f, 8);
+
+	opt[0] = nexthdr;
+	opt[1] = 0;
+	opt[2] = 1; // PadN
+	opt[3] = 4;
+}
+
+static void push_ipv6_frag(struct frame *f, __u8 nexthdr, __u16 frag_off)
+{
+	__u8 *frag = push(f, 8);
+
+	frag[0] = nexthdr;
+	*(__be16 *)&frag[2] = htons(frag_off);
+	*(__be32 *)&frag[4] = htonl(1);
+}
+
+static void push_gre(struct frame *f, __u16 proto)
+{
+	__be16 *gre = push(f, 4);
+
+	gre[0] = 0;
+	gre[1] = htons(proto);
+}
+
+#define GRE_KEY_PRESENT 0x2000
+#define TEST_KEY 42
+
+static void push_gre_key(struct frame *f, __u16 proto, __u32 key)
+{
+	__be16 *gre = push(f, 8);
+
+	gre[0] = htons(GRE_KEY_PRESENT);
+	gre[1] = htons(proto);
+	*(__be32 *)&gre[2] = htonl(key);
+}
+
+// an ip6gre netdev hands us a pseudo Ethernet header in front of the IPv6 header,
+// the underlay program a real one
+static void push_eth(struct frame *f, __u16 proto)
+{
+	struct ethhdr *eth = push(f, sizeof(*eth));
+
+	eth->h_proto = htons(proto);
+}
+
+static void pad(struct frame *f, __u32 len)
+{
+	push(f, len);
+}
+
+/* GRE over IPv4, frames start at the outer IPv4 header */
+
+static void gre4_keepalive(struct frame *f)
+{
+	struct iphdr *outer = push_ipv4(f, REMOTE4, LOCAL4, IPPROTO_GRE);
+	push_gre(f, ETH_P_IP);
+	struct iphdr *inner = push_ipv4(f, LOCAL4, REMOTE4, IPPROTO_GRE);
+	push_gre(f, 0);
+	finish_ipv4(f, inner);
+	finish_ipv4(f, outer);
+}
+
+static void gre4_keepalive_options(struct frame *f)
+{
+	struct iphdr *outer = push_ipv4(f, REMOTE4, LOCAL4, IPPROTO_GRE);
+	push_ipv4_ra(f, outer);
+	push_gre(f, ETH_P_IP);
+	struct iphdr *inner = push_ipv4(f, LOCAL4, REMOTE4, IPPROTO_GRE);
+	push_gre(f, 0);
+	finish_ipv4(f, inner);
+	finish_ipv4(f, outer);
+}
+
+// IPv6 payload on an IPv4 tunnel, see tunnels_setup()
+static void gre4_keepalive_ipv6(struct frame *f)
+{
+	struct iphdr *outer = push_ipv4(f, REMOTE4, LOCAL4, IPPROTO_GRE);
+	push_gre(f, ETH_P_IPV6);
+	struct ipv6hdr *inner = push_ipv6(f, INNER6_LOCAL, INNER6_REMOTE, IPPROTO_GRE);
+	push_gre(f, ETH_P_IPV6);
+	finish_ipv6(f, inner);
+	finish_ipv4(f, outer);
+}
+
+static void gre4_data(struct frame *f)
+{
+	struct iphdr *outer = push_ipv4(f, REMOTE4, LOCAL4, IPPROTO_GRE);
+	push_gre(f, ETH_P_IP);
+	struct iphdr *inner = push_ipv4(f, "198.51.100.1", "198.51.100.2", IPPROTO_UDP);
+	pad(f, 8 + 64);
+	finish_ipv4(f, inner);
+	finish_ipv4(f, outer);
+}
+
+// what the peer sends back for a keepalive xdp_gre_keepalived originated
+static void gre4_keepalive_reply(struct frame *f)
+{
+	struct iphdr *outer = push_ipv4(f, REMOTE4, LOCAL4, IPPROTO_GRE);
+	push_gre(f, 0);
+	finish_ipv4(f, outer);
+}
+
+static void gre4_addr_mismatch(struct frame *f)
+{
+	struct iphdr *outer = push_ipv4(f, REMOTE4, LOCAL4, IPPROTO_GRE);
+	push_gre(f, ETH_P_IP);
+	struct iphdr *inner = push_ipv4(f, LOCAL4, "198.51.100.2", IPPROTO_GRE);
+	push_gre(f, 0);
+	finish_ipv4(f, inner);
+	finish_ipv4(f, outer);
+}
+
+static void gre4_keepalive_keyed(struct frame *f)
+{
+	struct iphdr *outer = push_ipv4(f, REMOTE4, LOCAL4, IPPROTO_GRE);
+	push_gre_key(f, ETH_P_IP, TEST_KEY);
+	struct iphdr *inner = push_ipv4(f, LOCAL4, REMOTE4, IPPROTO_GRE);
+	push_gre_key(f, 0, TEST_KEY);
+	finish_ipv4(f, inner);
+	finish_ipv4(f, outer);
+}
+
+static void gre4_key_mismatch(struct frame *f)
+{
+	struct iphdr *outer = push_ipv4(f, REMOTE4, LOCAL4, IPPROTO_GRE);
+	push_gre_key(f, ETH_P_IP, TEST_KEY);
+	struct iphdr *inner = push_ipv4(f, LOCAL4, REMOTE4, IPPROTO_GRE);
+	push_gre_key(f, 0, TEST_KEY + 1);
+	finish_ipv4(f, inner);
+	finish_ipv4(f, outer);
+}
+
+static void gre4_trunc_outer_gre(struct frame *f)
+{
+	struct iphdr *outer = push_ipv4(f, REMOTE4, LOCAL4, IPPROTO_GRE);
+	pad(f, 2);
+	finish_ipv4(f, outer);
+}
+
+static void gre4_trunc_inner_ip(struct frame *f)
+{
+	struct iphdr *outer = push_ipv4(f, REMOTE4, LOCAL4, IPPROTO_GRE);
+	push_gre(f, ETH_P_IP);
+	struct iphdr *inner = push_ipv4(f, LOCAL4, REMOTE4, IPPROTO_GRE);
+	f->len -= sizeof(*inner) - 10;
+	finish_ipv4(f, outer);
+}
+
+static void gre4_not_ipv4(struct frame *f)
+{
+	push_ipv6(f, REMOTE6, LOCAL6, IPPROTO_GRE);
+	push_gre(f, ETH_P_IPV6);
+}
+
+static const struct bench_case gre4_cases[] = {
+	{ "keepalive", gre4_keepalive },
+	{ "keepalive-keyed", gre4_keepalive_keyed },
+	{ "keepalive-ip-options", gre4_keepalive_options },
+	{ "keepalive-ipv6-in-ipv4", gre4_keepalive_ipv6 },
+	{ "keepalive-reply", gre4_keepalive_reply },
+	{ "data", gre4_data },
+	{ "addr-mismatch", gre4_addr_mismatch },
+	{ "key-mismatch", gre4_key_mismatch },
+	{ "truncated-outer-gre", gre4_trunc_outer_gre },
+	{ "truncated-inner-ip", gre4_trunc_inner_ip },
+	{ "not-ipv4", gre4_not_ipv4 },
+	{ NULL, NULL },
+};
+
+/* GRE over IPv6, frames start at the pseudo Ethernet header */
+
+static void gre6_keepalive(struct frame *f)
+{
+	push_eth(f, ETH_P_IPV6);
+	struct ipv6hdr *outer = push_ipv6(f, REMOTE6, LOCAL6, IPPROTO_GRE);
+	push_gre(f, ETH_P_IPV6);
+	struct ipv6hdr *inner = push_ipv6(f, LOCAL6, REMOTE6, IPPROTO_GRE);
+	push_gre(f, ETH_P_IPV6);
+	finish_ipv6(f, inner);
+	finish_ipv6(f, outer);
+}
+
+// destination options in front of both GRE headers
+static void gre6_keepalive_ext(struct frame *f)
+{
+	push_eth(f, ETH_P_IPV6);
+	struct ipv6hdr *outer = push_ipv6(f, REMOTE6, LOCAL6, IPPROTO_DSTOPTS);
+	push_ipv6_opts(f, IPPROTO_GRE);
+	push_gre(f, ETH_P_IPV6);
+	struct ipv6hdr *inner = push_ipv6(f, LOCAL6, REMOTE6, IPPROTO_DSTOPTS);
+	push_ipv6_opts(f, IPPROTO_GRE);
+	push_gre(f, ETH_P_IPV6);
+	finish_ipv6(f, inner);
+	finish_ipv6(f, outer);
+}
+
+// first fragment of a larger packet, for the stack to reassemble
+static void gre6_fragment(struct frame *f)
+{
+	push_eth(f, ETH_P_IPV6);
+	struct ipv6hdr *outer = push_ipv6(f, REMOTE6, LOCAL6, IPPROTO_FRAGMENT);
+	push_ipv6_frag(f, IPPROTO_GRE, 1); // M flag
+	push_gre(f, ETH_P_IPV6);
+	pad(f, 64);
+	finish_ipv6(f, outer);
+}
+
+static void gre6_data(struct frame *f)
+{
+	push_eth(f, ETH_P_IPV6);
+	struct ipv6hdr *outer = push_ipv6(f, REMOTE6, LOCAL6, IPPROTO_GRE);
+	push_gre(f, ETH_P_IPV6);
+	struct ipv6hdr *inner = push_ipv6(f, "2001:db8:1::1", "2001:db8:1::2", IPPROTO_UDP);
+	pad(f, 8 + 64);
+	finish_ipv6(f, inner);
+	finish_ipv6(f, outer);
+}
+
+static void gre6_keepalive_reply(struct frame *f)
+{
+	push_eth(f, ETH_P_IPV6);
+	struct ipv6hdr *outer = push_ipv6(f, REMOTE6, LOCAL6, IPPROTO_GRE);
+	push_gre(f, 0);
+	finish_ipv6(f, outer);
+}
+
+static void gre6_addr_mismatch(struct frame *f)
+{
+	push_eth(f, ETH_P_IPV6);
+	struct ipv6hdr *outer = push_ipv6(f, REMOTE6, LOCAL6, IPPROTO_GRE);
+	push_gre(f, ETH_P_IPV6);
+	struct ipv6hdr *inner = push_ipv6(f, LOCAL6, "2001:db8:1::2", IPPROTO_GRE);
+	push_gre(f, ETH_P_IPV6);
+	finish_ipv6(f, inner);
+	finish_ipv6(f, outer);
+}
+
+static void gre6_trunc_outer_ip(struct frame *f)
+{
+	push_eth(f, ETH_P_IPV6);
+	push_ipv6(f, REMOTE6, LOCAL6, IPPROTO_GRE);
+	f->len -= sizeof(struct ipv6hdr) - 8;
+}
+
+static void gre6_trunc_inner_gre(struct frame *f)
+{
+	push_eth(f, ETH_P_IPV6);
+	struct ipv6hdr *outer = push_ipv6(f, REMOTE6, LOCAL6, IPPROTO_GRE);
+	push_gre(f, ETH_P_IPV6);
+	push_ipv6(f, LOCAL6, REMOTE6, IPPROTO_GRE);
+	pad(f, 2);
+	finish_ipv6(f, outer);
+}
+
+static void gre6_not_ipv6(struct frame *f)
+{
+	push_eth(f, ETH_P_IP);
+	struct iphdr *outer = push_ipv4(f, REMOTE4, LOCAL4, IPPROTO_GRE);
+	push_gre(f, ETH_P_IP);
+	finish_ipv4(f, outer);
+}
+
+static const struct bench_case gre6_cases[] = {
+	{ "keepalive", gre6_keepalive },
+	{ "keepalive-reply", gre6_keepalive_reply },
+	{ "keepalive-ext-headers", gre6_keepalive_ext },
+	{ "data", gre6_data },
+	{ "fragment", gre6_fragment },
+	{ "addr-mismatch", gre6_addr_mismatch },
+	{ "truncated-outer-ip", gre6_trunc_outer_ip },
+	{ "truncated-inner-gre", gre6_trunc_inner_gre },
+	{ "not-ipv6", gre6_not_ipv6 },
+	{ NULL, NULL },
+};
+
+/* both kinds of tunnel netdev, same frames as above */
+
+static const struct bench_case dual_cases[] = {
+	{ "keepalive-ipv4", gre4_keepalive },
+	{ "keepalive-ipv6", gre6_keepalive },
+	{ "keepalive-ipv6-in-ipv4", gre4_keepalive_ipv6 },
+	{ "keepalive-reply-ipv4", gre4_keepalive_reply },
+	{ "keepalive-reply-ipv6", gre6_keepalive_reply },
+	{ "data-ipv4", gre4_data },
+	{ "data-ipv6", gre6_data },
+	{ "truncated-outer-gre", gre4_trunc_outer_gre },
+	{ "truncated-outer-ipv6", gre6_trunc_outer_ip },
+	{ NULL, NULL },
+};
+
+/* underlay NIC, frames start at the Ethernet header */
+
+static void underlay_keepalive4(struct frame *f)
+{
+	push_eth(f, ETH_P_IP);
+	gre4_keepalive(f);
+}
+
+static void underlay_keepalive6(struct frame *f)
+{
+	gre6_keepalive(f);
+}
+
+static void underlay_keepalive4_keyed(struct frame *f)
+{
+	push_eth(f, ETH_P_IP);
+	gre4_keepalive_keyed(f);
+}
+
+static void underlay_keepalive_reply4(struct frame *f)
+{
+	push_eth(f, ETH_P_IP);
+	gre4_keepalive_reply(f);
+}
+
+static void underlay_keepalive6in4(struct frame *f)
+{
+	push_eth(f, ETH_P_IP);
+	gre4_keepalive_ipv6(f);
+}
+
+// gretap: the inner packet behind an Ethernet header of its own
+static void underlay_keepalive_gretap(struct frame *f)
+{
+	push_eth(f, ETH_P_IP);
+	struct iphdr *outer = push_ipv4(f, REMOTE4, LOCAL4, IPPROTO_GRE);
+	push_gre(f, ETH_P_TEB);
+	push_eth(f, ETH_P_IP);
+	struct iphdr *inner = push_ipv4(f, LOCAL4, REMOTE4, IPPROTO_GRE);
+	push_gre(f, 0);
+	finish_ipv4(f, inner);
+	finish_ipv4(f, outer);
+}
+
+// on a trunk port, one 802.1Q tag between the Ethernet and outer IP headers
+static void underlay_keepalive_vlan(struct frame *f)
+{
+	push_eth(f, ETH_P_8021Q);
+	struct vlan_hdr *vlan = push(f, sizeof(*vlan));
+	vlan->h_vlan_TCI = htons(100);
+	vlan->h_vlan_encapsulated_proto = htons(ETH_P_IP);
+	gre4_keepalive(f);
+}
+
+static void underlay_data4(struct frame *f)
+{
+	push_eth(f, ETH_P_IP);
+	gre4_data(f);
+}
+
+static void underlay_unknown_tunnel(struct frame *f)
+{
+	push_eth(f, ETH_P_IP);
+	struct iphdr *outer = push_ipv4(f, "198.51.100.9", LOCAL4, IPPROTO_GRE);
+	push_gre(f, ETH_P_IP);
+	struct iphdr *inner = push_ipv4(f, LOCAL4, "198.51.100.9", IPPROTO_GRE);
+	push_gre(f, 0);
+	finish_ipv4(f, inner);
+	finish_ipv4(f, outer);
+}
+
+static void underlay_not_gre(struct frame *f)
+{
+	push_eth(f, ETH_P_IP);
+	struct iphdr *iph = push_ipv4(f, "198.51.100.1", LOCAL4, IPPROTO_UDP);
+	pad(f, 8 + 64);
+	finish_ipv4(f, iph);
+}
+
+static void underlay_trunc_gre(struct frame *f)
+{
+	push_eth(f, ETH_P_IP);
+	gre4_trunc_outer_gre(f);
+}
+
+static const struct bench_case underlay_cases[] = {
+	{ "keepalive-ipv4", underlay_keepalive4 },
+	{ "keepalive-ipv6", underlay_keepalive6 },
+	{ "keepalive-ipv4-keyed", underlay_keepalive4_keyed },
+	{ "keepalive-ipv6-in-ipv4", underlay_keepalive6in4 },
+	{ "keepalive-gretap", underlay_keepalive_gretap },
+	{ "keepalive-vlan", underlay_keepalive_vlan },
+	{ "keepalive-reply-ipv4", underlay_keepalive_reply4 },
+	{ "data-ipv4", underlay_data4 },
+	{ "unknown-tunnel", underlay_unknown_tunnel },
+	{ "not-gre", underlay_not_gre },
+	{ "truncated-outer-gre", underlay_trunc_gre },
+	{ NULL, NULL },
+};
+
+// the tunnels of the crafted frames, which the underlay programs answer for
+// and where every program finds the inner addresses of the IPv4 tunnel
+static int tunnels_setup(struct bpf_object *obj)
+{
+	int map_fd = bpf_object__find_map_fd_by_name(obj, "tunnel_endpoints");
+	struct tunnel_inner inner = {}, none = {};
+	struct tunnel_endpoint ep;
+
+	if (map_fd < 0)
+		return map_fd;
+	if (parse_tunnel_endpoint(INNER6_LOCAL, INNER6_REMOTE, &ep))
+		return -1;
+	inner.family = ep.family;
+	memcpy(inner.local, ep.local, sizeof(inner.local));
+	memcpy(inner.remote, ep.remote, sizeof(inner.remote));
+
+	if (parse_tunnel_endpoint(LOCAL4, REMOTE4, &ep) || bpf_map_update_elem(map_fd, &ep, &inner, BPF_ANY))
+		return -1;
+	if (parse_tunnel_endpoint(LOCAL6, REMOTE6, &ep) || bpf_map_update_elem(map_fd, &ep, &none, BPF_ANY))
+		return -1;
+	if (parse_tunnel_endpoint(LOCAL4, REMOTE4, &ep))
+		return -1;
+	ep.flags = TUNNEL_F_KEY;
+	ep.key = htonl(TEST_KEY);
+	if (bpf_map_update_elem(map_fd, &ep, &none, BPF_ANY))
+		return -1;
+	return 0;
+}
+
+static const struct bench_suite suites[] = {
+	{ "xdp_gre_keepalive_func", gre4_cases, tunnels_setup },
+	{ "xdp_keepalive_gre6", gre6_cases },
+	{ "xdp_keepalive_dual", dual_cases, tunnels_setup },
+	{ "xdp_keepalive_underlay", underlay_cases, tunnels_setup },
+	// the same program split into tail-called stages
+	{ "xdp_keepalive_pipeline", underlay_cases, tunnels_setup, "xdp_keepalive_underlay" },
+	{ NULL, NULL },
+};
+
+static int run_case(int prog_fd, const struct bench_suite *s, const struct bench_case *c, int repeat)
+{
+	struct frame f = { .len = 0 };
+	__u8 out[FRAME_MAX];
+	double ns;
+	int err;
+
+	c->build(&f);
+	// BPF_PROG_TEST_RUN refuses XDP frames shorter than an Ethernet header
+	if (f.len < ETH_HLEN)
+		pad(&f, ETH_HLEN - f.len);
+
+	LIBBPF_OPTS(bpf_test_run_opts, probe,
+		.data_in = f.data,
+		.data_size_in = f.len,
+		.data_out = out,
+		.data_size_out = sizeof(out),
+		.repeat = 1,
+	);
+	err = bpf_prog_test_run_opts(prog_fd, &probe);
+	if (err) {
+		fprintf(stderr, "  %-24s test run failed: %s\n", c->name, strerror(errno));
+		return err;
+	}
+
+	// the kernel runs all repetitions on the same buffer, so a program
+	// which rewrote the frame (e.g. XDP_TX after bpf_xdp_adjust_head) would
+	// see its own output from the second run on. Time those frames one
+	// run at a time instead; the kernel-side duration excludes the syscall.
+	bool rewritten = probe.data_size_out != f.len || memcmp(out, f.data, f.len);
+	if (rewritten) {
+		__u64 total = 0;
+
+		for (int i = 0; i < repeat; ++i) {
+			LIBBPF_OPTS(bpf_test_run_opts, once,
+				.data_in = f.data,
+				.data_size_in = f.len,
+				.repeat = 1,
+			);
+			err = bpf_prog_test_run_opts(prog_fd, &once);
+			if (err)
+				break;
+			total += once.duration;
+		}
+		ns = (double)total / repeat;
+	} else {
+		LIBBPF_OPTS(bpf_test_run_opts, timed,
+			.data_in = f.data,
+			.data_size_in = f.len,
+			.repeat = repeat,
+		);
+		err = bpf_prog_test_run_opts(prog_fd, &timed);
+		ns = timed.duration;
+	}
+	if (err) {
+		fprintf(stderr, "  %-24s test run failed: %s\n", c->name, strerror(errno));
+		return err;
+	}
+
+	printf("  %-24s %-14s %10.1f%s %5u -> %u bytes\n", c->name, verdict_name(probe.retval),
+		ns, rewritten ? "*" : " ", f.len, probe.data_size_out);
+	if (nr_results < MAX_RESULTS)
+		results[nr_results++] = (struct bench_result){ s->prog_name, c->name, ns };
+	return 0;
+}
+
+static const struct bench_result *find_result(const char *prog_name, const char *case_name)
+{
+	for (int i = 0; i < nr_results; ++i) {
+		if (!strcmp(results[i].prog_name, prog_name) && !strcmp(results[i].case_name, case_name))
+			return &results[i];
+	}
+	return NULL;
+}
+
+// after all objects ran, whatever order they were given in
+static void print_comparisons(void)
+{
+	for (const struct bench_suite *s = suites; s->prog_name; ++s) {
+		bool header = false;
+
+		if (!s->compare_with)
+			continue;
+		for (const struct bench_case *c = s->cases; c->name; ++c) {
+			const struct bench_result *r = find_result(s->prog_name, c->name);
+			const struct bench_result *base = find_result(s->compare_with, c->name);
+
+			if (!r || !base)
+				continue;
+			if (!header) {
+				printf("%s compared with %s\n", s->prog_name, s->compare_with);
+				printf("  %-24s %10s %10s %10s\n", "case", "ns/pkt", "baseline", "delta");
+				header = true;
+			}
+			printf("  %-24s %10.1f %10.1f %+10.1f\n", c->name, r->ns, base->ns, r->ns - base->ns);
+		}
+	}
+}
+
+static int bench_object(const char *path, int repeat)
+{
+	struct bpf_object *obj;
+	struct bpf_program *prog;
+	int err = 0;
+
+	obj = xdp_object_open(path);
+	if (!obj)
+		return -1;
+
+	if (bpf_object__load(obj)) {
+		fprintf(stderr, "%s: load failed: %s\n", path, strerror(errno));
+		bpf_object__close(obj);
+		return -1;
+	}
+
+	bpf_object__for_each_program(prog, obj) {
+		const struct bench_suite *s;
+
+		for (s = suites; s->prog_name; ++s)
+			if (!strcmp(s->prog_name, bpf_program__name(prog)))
+				break;
+		if (!s->prog_name) {
+			printf("%s: %s: no benchmark cases, skipped\n", path, bpf_program__name(prog));
+			continue;
+		}
+
+		if (s->setup && s->setup(obj)) {
+			fprintf(stderr, "%s: %s: setup failed\n", path, s->prog_name);
+			err = -1;
+			continue;
+		}
+
+		printf("%s: %s\n", path, s->prog_name);
+		printf("  %-24s %-14s %11s %14s\n", "case", "verdict", "ns/pkt", "frame");
+		for (const struct bench_case *c = s->cases; c->name; ++c)
+			err |= run_case(bpf_program__fd(prog), s, c, repeat);
+	}
+
+	bpf_object__close(obj);
+	return err;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-r repeat] object.o...\n"
+		"  -r, --repeat N   runs per case (default %d)\n",
+		prog, DEFAULT_REPEAT);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "repeat", required_argument, NULL, 'r' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	int repeat = DEFAULT_REPEAT;
+	int opt, err = 0;
+
+	while ((opt = getopt_long(argc, argv, "r:h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'r':
+			repeat = atoi(optarg);
+			if (repeat <= 0) {
+				fprintf(stderr, "Invalid repeat count: %s\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (int i = optind; i < argc; ++i)
+		err |= bench_object(argv[i], repeat);
+
+	printf("* frame is rewritten by the program, timed one run per syscall\n");
+	print_comparisons();
+	return err ? 1 : 0;
+}
@@ -0,0 +1,1353 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+// Long-running loader for the keepalive programs.
+//
+// Each object is built into the daemon as a libbpf skeleton, loaded once and
+// its program is attached to every tunnel of the matching type through a
+// bpf_link. Ethernet interfaces get the underlay program, which answers for
+// the tunnels listed in a file. Programs, maps and links are pinned under the
+// pin directory so other tools can find them; everything is detached and
+// unpinned again when the daemon is stopped.
+//
+// With --keepalive the daemon also originates keepalives for the tunnels in
+// the tunnels file, the programs record the replies in tunnel_liveness.
+//
+// With --no-attach the interfaces are left to the libxdp dispatcher, which
+// loads its own copy of an object and finds the maps pinned by name under
+// the object's pin directory; the daemon keeps filling and reading them.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/types.h>
+#include <linux/bpf.h>
+#include <linux/if_arp.h>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include "common_user.h"
+#include "keepalive_sender.h"
+#include "liveness_watcher.h"
+#include "xsk_service.h"
+#include "keepalive_dual.skel.h"
+#include "keepalive_underlay.skel.h"
+
+#define DEFAULT_PIN_DIR "/sys/fs/bpf/gre_keepalive"
+
+// one loaded object, shared by every tunnel of its type
+struct keepalive_object {
+	const char *name;
+	// open the embedded object with the settings in its .rodata, see
+	// KEEPALIVE_SKELETON()
+	struct bpf_object *(*open)(struct keepalive_object *ko);
+	void (*destroy)(struct keepalive_object *ko);
+	// can hand keepalive replies to the AF_XDP service, see --xsk
+	bool xsk;
+	void *skel;
+	struct bpf_object_skeleton *skeleton;
+	struct bpf_object *obj;
+	struct bpf_program *prog;
+};
+
+struct tunnel {
+	char ifname[IF_NAMESIZE];
+	int ifindex;
+	int type;
+	struct keepalive_object *ko;
+	int link_fd;
+};
+
+static struct {
+	const char *pin_dir;
+	const char *tunnels_file;
+	const char *allowlist_file;
+	const char *profiles_file;
+	__u32 xdp_flags;
+	__u32 malformed_action;
+	int keepalive_interval;
+	int liveness_timeout;
+	struct ratelimit_config ratelimit;
+	bool debug_print;
+	__u32 debug_header_size;
+	bool stats_enabled;
+	bool ratelimit_enabled;
+	bool profiles_enabled;
+	const char *xsk_ifname;
+	__u32 xsk_queue;
+	__u8 xsk_gateway[ETH_ALEN];
+	bool xsk_gateway_set;
+	bool no_attach;
+} cfg = {
+	.pin_dir = DEFAULT_PIN_DIR,
+	.malformed_action = XDP_DROP,
+	.stats_enabled = true,
+	.ratelimit_enabled = true,
+	.profiles_enabled = true,
+};
+
+// The skeletons only differ in their type, this spells out the same typed
+// setup for each of them.
+#define KEEPALIVE_SKELETON(skel_name)						\
+static struct bpf_object *skel_name##_open(struct keepalive_object *ko)		\
+{										\
+	struct skel_name *skel = skel_name##__open();				\
+										\
+	if (!skel)								\
+		return NULL;							\
+	skel->rodata->malformed_action = cfg.malformed_action;			\
+	skel->rodata->liveness_timeout_ns = cfg.liveness_timeout * 1000000000ULL; \
+	skel->rodata->debug_print = cfg.debug_print;				\
+	skel->rodata->debug_header_size = cfg.debug_header_size;		\
+	skel->rodata->stats_enabled = cfg.stats_enabled;			\
+	skel->rodata->ratelimit_enabled = cfg.ratelimit_enabled;		\
+	skel->rodata->profiles_enabled = cfg.profiles_enabled;			\
+	skel->rodata->xsk_replies = ko->xsk && cfg.xsk_ifname;			\
+	ko->skel = skel;							\
+	ko->skeleton = skel->skeleton;						\
+	return skel->obj;							\
+}										\
+										\
+static void skel_name##_destroy(struct keepalive_object *ko)			\
+{										\
+	skel_name##__destroy(ko->skel);						\
+	ko->skel = NULL;							\
+	ko->skeleton = NULL;							\
+}
+
+KEEPALIVE_SKELETON(keepalive_dual)
+KEEPALIVE_SKELETON(keepalive_underlay)
+
+static struct keepalive_object objects[] = {
+	{ "keepalive_dual", keepalive_dual_open, keepalive_dual_destroy },
+	{ "keepalive_underlay", keepalive_underlay_open, keepalive_underlay_destroy, true },
+};
+
+// gre and ip6gre tunnels share the dual-stack program
+static const struct {
+	unsigned int netdev_type;
+	struct keepalive_object *ko;
+} netdev_objects[] = {
+	{ ARPHRD_IPGRE, &objects[0] },
+	{ ARPHRD_IP6GRE, &objects[0] },
+	{ ARPHRD_ETHER, &objects[1] },
+};
+
+static struct tunnel *tunnels;
+static int nr_tunnels;
+
+// from the tunnels file, answered by the underlay program and sent keepalives,
+// with the inner addresses of each for the cross-family keepalives
+static struct tunnel_endpoint *endpoints;
+static struct tunnel_inner *inners;
+static int nr_endpoints;
+
+// LPM trie shared by every object's peer_allowlist, -1 without --allow
+static int allowlist_fd = -1;
+
+// from --profiles, all zero (the built-in ones) otherwise
+static struct keepalive_profile profiles[PROFILE_MAX];
+
+// keep_attached: SIGUSR2 leaves programs, links and maps pinned for the
+// daemon that takes over
+static volatile sig_atomic_t exiting, reload, keep_attached;
+
+static void on_signal(int sig)
+{
+	exiting = 1;
+}
+
+static void on_sigusr2(int sig)
+{
+	keep_attached = 1;
+	exiting = 1;
+}
+
+static void on_sighup(int sig)
+{
+	reload = 1;
+}
+
+static int mkdir_p(const char *path)
+{
+	char buf[PATH_MAX];
+
+	snprintf(buf, sizeof(buf), "%s", path);
+	for (char *p = buf + 1; *p; ++p) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		if (mkdir(buf, 0700) && errno != EEXIST)
+			return -errno;
+		*p = '/';
+	}
+	if (mkdir(buf, 0700) && errno != EEXIST)
+		return -errno;
+	return 0;
+}
+
+// drop every pin left in dir, e.g. by a previous instance that was killed
+static void clear_pin_dir(const char *dir)
+{
+	char path[PATH_MAX];
+	struct dirent *ent;
+	DIR *d = opendir(dir);
+
+	if (!d)
+		return;
+	while ((ent = readdir(d))) {
+		if (ent->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+		unlink(path);
+	}
+	closedir(d);
+}
+
+static int netdev_type(const char *ifname)
+{
+	char path[PATH_MAX];
+	unsigned int type;
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/type", ifname);
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+	ret = fscanf(f, "%u", &type) == 1 ? (int)type : -EINVAL;
+	fclose(f);
+	return ret;
+}
+
+// IFLA_INFO_KIND of a netdev, left empty for devices without one
+static int netdev_kind(int ifindex, char *kind, size_t size)
+{
+	struct {
+		struct nlmsghdr nh;
+		struct ifinfomsg ifi;
+	} req = {
+		.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+		.nh.nlmsg_type = RTM_GETLINK,
+		.nh.nlmsg_flags = NLM_F_REQUEST,
+		.ifi.ifi_family = AF_UNSPEC,
+		.ifi.ifi_index = ifindex,
+	};
+	char buf[16384];
+	struct nlmsghdr *nh = (struct nlmsghdr *)buf;
+	struct rtattr *rta, *info;
+	int fd, len, infolen, ret = -EINVAL;
+
+	kind[0] = '\0';
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0)
+		return -errno;
+	if (send(fd, &req, req.nh.nlmsg_len, 0) < 0) {
+		ret = -errno;
+		goto out;
+	}
+	len = recv(fd, buf, sizeof(buf), 0);
+	if (len < 0) {
+		ret = -errno;
+		goto out;
+	}
+	if (!NLMSG_OK(nh, (unsigned int)len))
+		goto out;
+	if (nh->nlmsg_type == NLMSG_ERROR) {
+		ret = ((struct nlmsgerr *)NLMSG_DATA(nh))->error;
+		goto out;
+	}
+	if (nh->nlmsg_type != RTM_NEWLINK)
+		goto out;
+
+	ret = 0;
+	len = IFLA_PAYLOAD(nh);
+	for (rta = IFLA_RTA(NLMSG_DATA(nh)); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type != IFLA_LINKINFO)
+			continue;
+		infolen = RTA_PAYLOAD(rta);
+		for (info = RTA_DATA(rta); RTA_OK(info, infolen); info = RTA_NEXT(info, infolen))
+			if (info->rta_type == IFLA_INFO_KIND)
+				snprintf(kind, size, "%s", (char *)RTA_DATA(info));
+	}
+out:
+	close(fd);
+	return ret;
+}
+
+static struct keepalive_object *object_for_type(int type)
+{
+	for (size_t i = 0; i < sizeof(netdev_objects) / sizeof(netdev_objects[0]); ++i)
+		if (netdev_objects[i].netdev_type == (unsigned int)type)
+			return netdev_objects[i].ko;
+	return NULL;
+}
+
+static bool is_configured_endpoint(const struct tunnel_endpoint *ep)
+{
+	for (int i = 0; i < nr_endpoints; ++i)
+		if (!memcmp(ep, &endpoints[i], sizeof(*ep)))
+			return true;
+	return false;
+}
+
+static int load_tunnel_endpoints(struct keepalive_object *ko)
+{
+	struct tunnel_endpoint key, next;
+	void *prev = NULL;
+	int map_fd;
+
+	map_fd = bpf_object__find_map_fd_by_name(ko->obj, "tunnel_endpoints");
+	if (map_fd < 0)
+		return 0;
+	// the tunnel netdev programs only look up cross-family keepalives here
+	if (!nr_endpoints && ko->xsk) {
+		fprintf(stderr, "%s: no tunnels given, no keepalive will be answered\n", ko->name);
+		return 0;
+	}
+
+	for (int i = 0; i < nr_endpoints; ++i) {
+		if (bpf_map_update_elem(map_fd, &endpoints[i], &inners[i], BPF_ANY)) {
+			int err = -errno;
+
+			fprintf(stderr, "Cannot add tunnel %d: %s\n", i + 1, strerror(-err));
+			return err;
+		}
+	}
+
+	// a map taken over from a previous daemon may still hold tunnels that
+	// are gone from the file, drop them only once the current ones are in
+	while (!bpf_map_get_next_key(map_fd, prev, &next)) {
+		if (!is_configured_endpoint(&next) && !bpf_map_delete_elem(map_fd, &next))
+			continue; // carry on from the key before it
+		key = next;
+		prev = &key;
+	}
+	return 0;
+}
+
+// "RATE[/BURST]" reflected keepalives per second and peer, burst defaults to
+// one second worth of keepalives
+static int parse_ratelimit(const char *str, struct ratelimit_config *rl)
+{
+	double rate, burst;
+	char *end;
+
+	rate = strtod(str, &end);
+	if (end == str || rate <= 0)
+		return -EINVAL;
+	burst = rate < 1 ? 1 : (__u64)rate;
+	if (*end == '/') {
+		str = end + 1;
+		burst = strtod(str, &end);
+		if (end == str || burst < 1)
+			return -EINVAL;
+	}
+	if (*end)
+		return -EINVAL;
+
+	rl->interval_ns = 1e9 / rate;
+	rl->burst_ns = (__u64)burst * rl->interval_ns;
+	return 0;
+}
+
+// allow-list file: one "ADDRESS[/PREFIXLEN]" per line, # starts a comment.
+// Returns a new LPM trie holding all of them.
+static int read_allowlist(const char *path)
+{
+	LIBBPF_OPTS(bpf_map_create_opts, opts, .map_flags = BPF_F_NO_PREALLOC);
+	char line[256], addr[INET6_ADDRSTRLEN + 4];
+	unsigned int lineno = 0;
+	int fd, err = 0;
+	__u32 one = 1;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		err = -errno;
+		fprintf(stderr, "Cannot open %s: %s\n", path, strerror(-err));
+		return err;
+	}
+	fd = bpf_map_create(BPF_MAP_TYPE_LPM_TRIE, "allowlist", sizeof(struct allowlist_key),
+			    sizeof(__u32), MAX_TUNNELS, &opts);
+	if (fd < 0) {
+		err = -errno;
+		fprintf(stderr, "Cannot create allow-list: %s\n", strerror(errno));
+		goto out;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		struct allowlist_key key = {};
+		int maxlen, prefixlen = -1;
+		char *slash;
+
+		++lineno;
+		line[strcspn(line, "#")] = '\0';
+		if (sscanf(line, "%49s", addr) != 1)
+			continue;
+		slash = strchr(addr, '/');
+		if (slash) {
+			*slash = '\0';
+			prefixlen = atoi(slash + 1);
+		}
+		if (inet_pton(AF_INET, addr, key.peer.addr) == 1) {
+			key.peer.family = TUNNEL_FAMILY_IPV4;
+			maxlen = 32;
+		} else if (inet_pton(AF_INET6, addr, key.peer.addr) == 1) {
+			key.peer.family = TUNNEL_FAMILY_IPV6;
+			maxlen = 128;
+		} else {
+			maxlen = -1;
+		}
+		if (prefixlen < 0)
+			prefixlen = maxlen;
+		if (maxlen < 0 || prefixlen > maxlen) {
+			fprintf(stderr, "%s:%u: invalid prefix\n", path, lineno);
+			err = -EINVAL;
+			break;
+		}
+		key.prefixlen = 32 + prefixlen;
+		if (bpf_map_update_elem(fd, &key, &one, BPF_ANY)) {
+			err = -errno;
+			fprintf(stderr, "%s:%u: cannot add prefix: %s\n", path, lineno, strerror(errno));
+			break;
+		}
+	}
+
+out:
+	fclose(f);
+	if (err) {
+		if (fd >= 0)
+			close(fd);
+		return err;
+	}
+	return fd;
+}
+
+static int install_allowlist(struct keepalive_object *ko)
+{
+	int outer_fd = bpf_object__find_map_fd_by_name(ko->obj, "peer_allowlist");
+	__u32 zero = 0;
+
+	if (outer_fd < 0)
+		return 0;
+	// a reused pinned map may still hold the list of a previous daemon
+	if (allowlist_fd < 0) {
+		if (bpf_map_delete_elem(outer_fd, &zero) && errno != ENOENT) {
+			int err = -errno;
+
+			fprintf(stderr, "%s: cannot clear allow-list: %s\n", ko->name, strerror(-err));
+			return err;
+		}
+		return 0;
+	}
+	if (bpf_map_update_elem(outer_fd, &zero, &allowlist_fd, BPF_ANY)) {
+		int err = -errno;
+
+		fprintf(stderr, "%s: cannot install allow-list: %s\n", ko->name, strerror(-err));
+		return err;
+	}
+	return 0;
+}
+
+// build the new list completely, then swap it in; a broken file keeps the old one
+static void reload_allowlist(void)
+{
+	int old_fd = allowlist_fd;
+	int fd = read_allowlist(cfg.allowlist_file);
+
+	if (fd < 0) {
+		fprintf(stderr, "Keeping the previous allow-list\n");
+		return;
+	}
+	allowlist_fd = fd;
+	for (size_t i = 0; i < sizeof(objects) / sizeof(objects[0]); ++i)
+		if (objects[i].obj)
+			install_allowlist(&objects[i]);
+	close(old_fd);
+	printf("Reloaded allow-list %s\n", cfg.allowlist_file);
+}
+
+// vendor profile file: "ipv4|ipv6 PROTO[,PROTO...] [any-key]" per line, #
+// starts a comment. A family that is not listed keeps the built-in profile.
+static int read_profiles(const char *path, struct keepalive_profile *out)
+{
+	char line[256], family[8], protos[128], flag[16];
+	unsigned int lineno = 0;
+	int err = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		err = -errno;
+		fprintf(stderr, "Cannot open %s: %s\n", path, strerror(-err));
+		return err;
+	}
+	memset(out, 0, PROFILE_MAX * sizeof(*out));
+	while (fgets(line, sizeof(line), f)) {
+		struct keepalive_profile *profile;
+		int fields;
+
+		++lineno;
+		line[strcspn(line, "#")] = '\0';
+		fields = sscanf(line, "%7s %127s %15s", family, protos, flag);
+		if (fields < 1)
+			continue;
+		if (!strcmp(family, "ipv4")) {
+			profile = &out[PROFILE_INNER_IPV4];
+		} else if (!strcmp(family, "ipv6")) {
+			profile = &out[PROFILE_INNER_IPV6];
+		} else {
+			fprintf(stderr, "%s:%u: unknown family %s\n", path, lineno, family);
+			err = -EINVAL;
+			break;
+		}
+		if (fields < 2) {
+			fprintf(stderr, "%s:%u: no protocols\n", path, lineno);
+			err = -EINVAL;
+			break;
+		}
+		profile->nr_protos = 0;
+		for (char *tok = strtok(protos, ","); tok; tok = strtok(NULL, ",")) {
+			unsigned long proto;
+			char *end;
+
+			proto = strtoul(tok, &end, 0);
+			if (*end || end == tok || proto > 0xffff
+			    || profile->nr_protos == KEEPALIVE_PROTOS_MAX) {
+				fprintf(stderr, "%s:%u: invalid protocol %s (at most %d per family)\n",
+					path, lineno, tok, KEEPALIVE_PROTOS_MAX);
+				err = -EINVAL;
+				break;
+			}
+			profile->protos[profile->nr_protos++] = htons(proto);
+		}
+		if (err)
+			break;
+		profile->flags = 0;
+		if (fields == 3) {
+			if (strcmp(flag, "any-key")) {
+				fprintf(stderr, "%s:%u: unknown flag %s\n", path, lineno, flag);
+				err = -EINVAL;
+				break;
+			}
+			profile->flags |= PROFILE_F_ANY_KEY;
+		}
+	}
+	fclose(f);
+	return err;
+}
+
+static int install_profiles(struct keepalive_object *ko)
+{
+	int map_fd = bpf_object__find_map_fd_by_name(ko->obj, "keepalive_profiles");
+
+	if (map_fd < 0)
+		return 0;
+	for (__u32 i = 0; i < PROFILE_MAX; ++i) {
+		if (bpf_map_update_elem(map_fd, &i, &profiles[i], BPF_ANY)) {
+			int err = -errno;
+
+			fprintf(stderr, "%s: cannot set vendor profile: %s\n", ko->name, strerror(-err));
+			return err;
+		}
+	}
+	return 0;
+}
+
+// like the allow-list, a broken file keeps the profiles in use
+static void reload_profiles(void)
+{
+	struct keepalive_profile new_profiles[PROFILE_MAX];
+
+	if (read_profiles(cfg.profiles_file, new_profiles)) {
+		fprintf(stderr, "Keeping the previous vendor profiles\n");
+		return;
+	}
+	memcpy(profiles, new_profiles, sizeof(profiles));
+	for (size_t i = 0; i < sizeof(objects) / sizeof(objects[0]); ++i)
+		if (objects[i].obj)
+			install_profiles(&objects[i]);
+	printf("Reloaded vendor profiles %s\n", cfg.profiles_file);
+}
+
+// Pick up the maps a previous daemon left pinned in dir, so counters, tunnel
+// state and rate limits carry over an upgrade; libbpf reuses whatever is
+// pinned at a map's pin path and pins the others there. A pinned map whose
+// definition changed starts over empty. .rodata holds this load's settings
+// and is never shared.
+static int reuse_pinned_maps(struct keepalive_object *ko, const char *dir)
+{
+	char path[PATH_MAX];
+	struct bpf_map *map;
+
+	bpf_object__for_each_map(map, ko->obj) {
+		struct bpf_map_info info = {};
+		__u32 len = sizeof(info);
+		int fd;
+
+		if (bpf_map__is_internal(map))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, bpf_map__name(map));
+		if (bpf_map__set_pin_path(map, path))
+			return -errno;
+
+		fd = bpf_obj_get(path);
+		if (fd < 0)
+			continue;
+		if (bpf_map_get_info_by_fd(fd, &info, &len)
+		    || info.type != bpf_map__type(map)
+		    || info.key_size != bpf_map__key_size(map)
+		    || info.value_size != bpf_map__value_size(map)
+		    || info.max_entries != bpf_map__max_entries(map)
+		    || info.map_flags != bpf_map__map_flags(map)) {
+			fprintf(stderr, "%s: pinned map %s does not fit, starting with an empty one\n",
+				ko->name, bpf_map__name(map));
+			unlink(path);
+		}
+		close(fd);
+	}
+	return 0;
+}
+
+static int load_object(struct keepalive_object *ko)
+{
+	char path[PATH_MAX], dir[PATH_MAX];
+	__u32 zero = 0;
+	int err;
+
+	if (ko->obj)
+		return 0;
+
+	snprintf(dir, sizeof(dir), "%s/%s", cfg.pin_dir, ko->name);
+	ko->obj = ko->open(ko);
+	if (!ko->obj) {
+		fprintf(stderr, "%s: open failed: %s\n", ko->name, strerror(errno));
+		return -1;
+	}
+	ko->prog = bpf_object__next_program(ko->obj, NULL);
+
+	err = mkdir_p(dir);
+	if (err) {
+		fprintf(stderr, "Cannot create %s: %s\n", dir, strerror(-err));
+		goto err;
+	}
+	if (reuse_pinned_maps(ko, dir))
+		goto err;
+
+	if (bpf_object__load_skeleton(ko->skeleton)) {
+		fprintf(stderr, "%s: load failed: %s\n", ko->name, strerror(errno));
+		goto err;
+	}
+	if (load_tunnel_endpoints(ko) || install_allowlist(ko) || install_profiles(ko))
+		goto err;
+	if (bpf_map_update_elem(bpf_object__find_map_fd_by_name(ko->obj, "ratelimit_config"), &zero,
+				&cfg.ratelimit, BPF_ANY)) {
+		fprintf(stderr, "%s: cannot configure rate limit: %s\n", ko->name, strerror(errno));
+		goto err;
+	}
+
+	// the maps are pinned by now, the program replaces any older version
+	snprintf(path, sizeof(path), "%s/%s", dir, bpf_program__name(ko->prog));
+	unlink(path);
+	if (bpf_program__pin(ko->prog, path)) {
+		fprintf(stderr, "Cannot pin program at %s: %s\n", path, strerror(errno));
+		goto err;
+	}
+	return 0;
+
+err:
+	// pins may belong to programs that are still attached, leave them
+	ko->destroy(ko);
+	ko->obj = NULL;
+	return -1;
+}
+
+static void unload_object(struct keepalive_object *ko)
+{
+	char dir[PATH_MAX];
+
+	if (!ko->obj)
+		return;
+	if (!keep_attached) {
+		snprintf(dir, sizeof(dir), "%s/%s", cfg.pin_dir, ko->name);
+		clear_pin_dir(dir);
+		rmdir(dir);
+	}
+	ko->destroy(ko);
+	ko->obj = NULL;
+}
+
+static int periodic_timer(int seconds)
+{
+	struct itimerspec ts = {
+		.it_interval = { .tv_sec = seconds },
+		.it_value = { .tv_nsec = 1 },
+	};
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+
+	if (fd < 0 || timerfd_settime(fd, 0, &ts, NULL)) {
+		fprintf(stderr, "Cannot create timer: %s\n", strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static bool timer_expired(struct pollfd *pfd)
+{
+	__u64 expirations;
+
+	if (!(pfd->revents & POLLIN))
+		return false;
+	return read(pfd->fd, &expirations, sizeof(expirations)) == sizeof(expirations);
+}
+
+// the AF_XDP service on the underlay interface given with --xsk
+static struct xsk_service *start_xsk_service(void)
+{
+	struct xsk_service_config xcfg = {
+		.ifname = cfg.xsk_ifname,
+		.queue = cfg.xsk_queue,
+		.timeout_ns = cfg.liveness_timeout * 1000000000ULL,
+	};
+	struct keepalive_object *ko = NULL;
+
+	for (int i = 0; i < nr_tunnels; ++i)
+		if (!strcmp(tunnels[i].ifname, cfg.xsk_ifname))
+			ko = tunnels[i].ko;
+	if (!ko || !ko->xsk) {
+		fprintf(stderr, "%s: --xsk needs the interface attached as underlay\n", cfg.xsk_ifname);
+		return NULL;
+	}
+	memcpy(xcfg.gateway, cfg.xsk_gateway, ETH_ALEN);
+	xcfg.xsks_map_fd = bpf_object__find_map_fd_by_name(ko->obj, "xsks_map");
+	xcfg.liveness_map_fd = bpf_object__find_map_fd_by_name(ko->obj, "tunnel_liveness");
+	return xsk_service_new(&xcfg, endpoints, nr_endpoints);
+}
+
+static void report_keepalives(int sent)
+{
+	if (sent >= 0 && sent < nr_endpoints)
+		fprintf(stderr, "Sent %d of %d keepalives\n", sent, nr_endpoints);
+}
+
+// Everything happens in this one thread: a single timer sends the keepalives
+// of all tunnels at once, resumed when a full socket buffer has room again,
+// another one looks for tunnels that timed out, and the programs' ring
+// buffers wake us up when a tunnel comes up. With --xsk the keepalives go out
+// and their replies come in through the AF_XDP socket.
+static int run(void)
+{
+	enum { POLL_SENDER, POLL_SENDER_OUT, POLL_EVENTS, POLL_SCAN, POLL_XSK, POLL_MAX };
+	struct keepalive_sender *sender = NULL;
+	struct xsk_service *xsk = NULL;
+	struct liveness_watcher *watcher;
+	struct pollfd pfds[POLL_MAX];
+	int err = 0;
+
+	// negative fds are ignored by poll()
+	for (int i = 0; i < POLL_MAX; ++i)
+		pfds[i] = (struct pollfd){ .fd = -1, .events = POLLIN };
+	pfds[POLL_SENDER_OUT].events = POLLOUT;
+
+	watcher = liveness_watcher_new(cfg.liveness_timeout * 1000000000ULL);
+	if (!watcher)
+		return -1;
+	for (size_t i = 0; i < sizeof(objects) / sizeof(objects[0]); ++i) {
+		if (objects[i].obj && liveness_watcher_add(watcher, objects[i].obj)) {
+			err = -1;
+			goto out;
+		}
+	}
+	pfds[POLL_EVENTS].fd = liveness_watcher_fd(watcher);
+	// a few looks per timeout keep the down report close to the deadline
+	pfds[POLL_SCAN].fd = periodic_timer(cfg.liveness_timeout > 3 ? cfg.liveness_timeout / 3 : 1);
+	if (pfds[POLL_SCAN].fd < 0) {
+		err = -1;
+		goto out;
+	}
+
+	if (cfg.keepalive_interval > 0) {
+		if (!nr_endpoints)
+			fprintf(stderr, "No tunnels given, no keepalive will be sent\n");
+		if (cfg.xsk_ifname) {
+			xsk = start_xsk_service();
+			if (!xsk) {
+				err = -1;
+				goto out;
+			}
+			pfds[POLL_XSK].fd = xsk_service_fd(xsk);
+		} else {
+			sender = keepalive_sender_new(endpoints, nr_endpoints);
+			if (!sender) {
+				err = -1;
+				goto out;
+			}
+		}
+		pfds[POLL_SENDER].fd = periodic_timer(cfg.keepalive_interval);
+		if (pfds[POLL_SENDER].fd < 0) {
+			err = -1;
+			goto out;
+		}
+	}
+
+	while (!exiting) {
+		if (reload) {
+			reload = 0;
+			if (cfg.allowlist_file)
+				reload_allowlist();
+			if (cfg.profiles_file)
+				reload_profiles();
+		}
+		if (xsk)
+			pfds[POLL_XSK].events = xsk_service_events(xsk);
+		if (sender)
+			pfds[POLL_SENDER_OUT].fd = keepalive_sender_fd(sender);
+		if (poll(pfds, POLL_MAX, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "poll failed: %s\n", strerror(errno));
+			err = -1;
+			break;
+		}
+		if (pfds[POLL_SENDER_OUT].revents & POLLOUT)
+			report_keepalives(keepalive_sender_resume(sender));
+		if (timer_expired(&pfds[POLL_SENDER])) {
+			if (xsk)
+				xsk_service_send(xsk);
+			else
+				report_keepalives(keepalive_sender_send(sender));
+		}
+		if (pfds[POLL_XSK].revents & (POLLIN | POLLOUT))
+			xsk_service_poll(xsk);
+		if (pfds[POLL_EVENTS].revents & POLLIN)
+			liveness_watcher_poll(watcher);
+		if (timer_expired(&pfds[POLL_SCAN]))
+			liveness_watcher_scan(watcher);
+	}
+
+out:
+	for (int i = 0; i < POLL_MAX; ++i)
+		if (pfds[i].fd >= 0 && i != POLL_SENDER_OUT && i != POLL_EVENTS && i != POLL_XSK)
+			close(pfds[i].fd);
+	keepalive_sender_free(sender);
+	xsk_service_free(xsk);
+	liveness_watcher_free(watcher);
+	return err;
+}
+
+static void link_pin_path(char *buf, size_t size, const char *ifname)
+{
+	snprintf(buf, size, "%s/links/%s", cfg.pin_dir, ifname);
+}
+
+// detach whatever link is pinned for ifname, returns 0 if there was none
+static int detach_pinned(const char *ifname)
+{
+	char path[PATH_MAX];
+	int fd, err;
+
+	link_pin_path(path, sizeof(path), ifname);
+	fd = bpf_obj_get(path);
+	if (fd < 0)
+		return errno == ENOENT ? 0 : -errno;
+	err = bpf_link_detach(fd);
+	close(fd);
+	unlink(path);
+	return err ? -errno : 1;
+}
+
+// Swap our program into the link a previous daemon left pinned for t, in one
+// step so no packet goes unanswered. BPF_F_REPLACE makes it fail rather than
+// replace a program someone else attached in the meantime. Returns the link
+// fd, 0 if there is no usable pinned link and a negative error otherwise.
+static int replace_pinned(struct tunnel *t)
+{
+	struct bpf_link_info info = {};
+	__u32 len = sizeof(info);
+	char path[PATH_MAX];
+	int fd, old_prog_fd;
+
+	link_pin_path(path, sizeof(path), t->ifname);
+	fd = bpf_obj_get(path);
+	if (fd < 0)
+		return errno == ENOENT ? 0 : -errno;
+	if (bpf_link_get_info_by_fd(fd, &info, &len) || info.type != BPF_LINK_TYPE_XDP
+	    || info.xdp.ifindex != (__u32)t->ifindex) {
+		// the interface was recreated, its old link is dead anyway
+		close(fd);
+		return 0;
+	}
+
+	old_prog_fd = bpf_prog_get_fd_by_id(info.prog_id);
+	if (old_prog_fd < 0) {
+		close(fd);
+		return -errno;
+	}
+	LIBBPF_OPTS(bpf_link_update_opts, opts, .flags = BPF_F_REPLACE, .old_prog_fd = old_prog_fd);
+	if (bpf_link_update(fd, bpf_program__fd(t->ko->prog), &opts)) {
+		int err = -errno;
+
+		close(old_prog_fd);
+		close(fd);
+		return err;
+	}
+	close(old_prog_fd);
+	return fd;
+}
+
+// The dual-stack program cannot tell an ip6gre frame from a gre one by its
+// first bytes alone, tell it the family of t. Other objects have no such map.
+static int register_netdev(struct tunnel *t)
+{
+	int map_fd = bpf_object__find_map_fd_by_name(t->ko->obj, "netdev_families");
+	__u32 ifindex = t->ifindex;
+	__u32 family = t->type == ARPHRD_IP6GRE ? TUNNEL_FAMILY_IPV6 : TUNNEL_FAMILY_IPV4;
+
+	if (map_fd < 0)
+		return 0;
+	if (bpf_map_update_elem(map_fd, &ifindex, &family, BPF_ANY)) {
+		int err = -errno;
+
+		fprintf(stderr, "%s: cannot register netdev: %s\n", t->ifname, strerror(-err));
+		return err;
+	}
+	return 0;
+}
+
+static int attach_tunnel(struct tunnel *t)
+{
+	char path[PATH_MAX];
+	int err;
+
+	err = load_object(t->ko);
+	if (!err)
+		err = register_netdev(t);
+	if (err)
+		return err;
+
+	t->link_fd = replace_pinned(t);
+	if (t->link_fd > 0) {
+		printf("%s: replaced program with %s\n", t->ifname, t->ko->name);
+		return 0;
+	}
+	if (t->link_fd < 0)
+		fprintf(stderr, "%s: cannot replace pinned link: %s\n", t->ifname, strerror(-t->link_fd));
+	if (detach_pinned(t->ifname) > 0)
+		fprintf(stderr, "%s: detached stale link\n", t->ifname);
+
+	LIBBPF_OPTS(bpf_link_create_opts, opts, .flags = cfg.xdp_flags);
+	t->link_fd = bpf_link_create(bpf_program__fd(t->ko->prog), t->ifindex, BPF_XDP, &opts);
+	if (t->link_fd < 0) {
+		fprintf(stderr, "%s: attach failed: %s\n", t->ifname, strerror(errno));
+		if (errno == EBUSY || errno == EEXIST)
+			fprintf(stderr, "%s: another XDP program is attached, share the interface "
+				"through libxdp with --no-attach\n", t->ifname);
+		return -1;
+	}
+
+	link_pin_path(path, sizeof(path), t->ifname);
+	if (bpf_obj_pin(t->link_fd, path))
+		fprintf(stderr, "%s: cannot pin link at %s: %s\n", t->ifname, path, strerror(errno));
+
+	printf("%s: attached %s\n", t->ifname, t->ko->name);
+	return 0;
+}
+
+// --no-attach: load the object for t and tell where libxdp finds its maps
+static int prepare_tunnel(struct tunnel *t)
+{
+	int err = load_object(t->ko);
+
+	if (!err)
+		err = register_netdev(t);
+	if (!err)
+		printf("%s: %s loaded, attach it with: xdp-loader load -p %s/%s %s %s.o\n",
+		       t->ifname, t->ko->name, cfg.pin_dir, t->ko->name, t->ifname, t->ko->name);
+	return err;
+}
+
+static void detach_tunnel(struct tunnel *t)
+{
+	char path[PATH_MAX];
+
+	if (t->link_fd < 0)
+		return;
+	if (keep_attached) {
+		// the pin keeps the link, and the program in it, alive
+		close(t->link_fd);
+		t->link_fd = -1;
+		return;
+	}
+	link_pin_path(path, sizeof(path), t->ifname);
+	unlink(path);
+	// the link goes away with its last reference
+	close(t->link_fd);
+	t->link_fd = -1;
+	printf("%s: detached\n", t->ifname);
+}
+
+static int add_tunnel(const char *ifname)
+{
+	char kind[IFNAMSIZ];
+	struct tunnel *t;
+	int type;
+
+	tunnels = realloc(tunnels, (nr_tunnels + 1) * sizeof(*tunnels));
+	if (!tunnels)
+		return -ENOMEM;
+	t = &tunnels[nr_tunnels];
+	memset(t, 0, sizeof(*t));
+	t->link_fd = -1;
+
+	snprintf(t->ifname, sizeof(t->ifname), "%s", ifname);
+	t->ifindex = if_nametoindex(ifname);
+	if (!t->ifindex) {
+		fprintf(stderr, "Unknown interface %s\n", ifname);
+		return -ENODEV;
+	}
+	type = netdev_type(ifname);
+	t->type = type;
+	t->ko = object_for_type(type);
+	if (!t->ko) {
+		fprintf(stderr, "%s: not a gre, ip6gre or Ethernet interface (type %d)\n", ifname, type);
+		return -EINVAL;
+	}
+	// gretap and ip6gretap are Ethernet devices too, but only see the
+	// bridged frames once the kernel removed the outer headers
+	if (type == ARPHRD_ETHER && !netdev_kind(t->ifindex, kind, sizeof(kind))
+	    && (!strcmp(kind, "gretap") || !strcmp(kind, "ip6gretap"))) {
+		fprintf(stderr, "%s: %s keepalives can only be answered on the underlay interface\n",
+			ifname, kind);
+		return -EINVAL;
+	}
+
+	nr_tunnels++;
+	return 0;
+}
+
+static void cleanup(void)
+{
+	char path[PATH_MAX];
+
+	for (int i = 0; i < nr_tunnels; ++i)
+		detach_tunnel(&tunnels[i]);
+	for (size_t i = 0; i < sizeof(objects) / sizeof(objects[0]); ++i)
+		unload_object(&objects[i]);
+
+	if (!keep_attached) {
+		snprintf(path, sizeof(path), "%s/links", cfg.pin_dir);
+		rmdir(path);
+		rmdir(cfg.pin_dir);
+	}
+	free(tunnels);
+	free(endpoints);
+	free(inners);
+	if (allowlist_fd >= 0)
+		close(allowlist_fd);
+}
+
+// IFACE[:QUEUE], queue 0 if not given
+static int parse_xsk(char *str)
+{
+	char *colon = strchr(str, ':');
+	char *end;
+
+	if (colon) {
+		*colon = '\0';
+		errno = 0;
+		cfg.xsk_queue = strtoul(colon + 1, &end, 0);
+		if (errno || *end || end == colon + 1 || cfg.xsk_queue >= MAX_XSK_QUEUES)
+			return -1;
+	}
+	cfg.xsk_ifname = str;
+	return *str ? 0 : -1;
+}
+
+static int parse_mac(const char *str, __u8 *mac)
+{
+	int len = 0;
+
+	if (sscanf(str, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx%n", &mac[0], &mac[1], &mac[2],
+		   &mac[3], &mac[4], &mac[5], &len) != 6 || str[len])
+		return -1;
+	return 0;
+}
+
+// "stats,rate-limit,profiles", turns off the features listed
+static int parse_disable(const char *str)
+{
+	char buf[64], *tok, *save;
+
+	snprintf(buf, sizeof(buf), "%s", str);
+	for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (!strcmp(tok, "stats")) {
+			cfg.stats_enabled = false;
+		} else if (!strcmp(tok, "rate-limit")) {
+			cfg.ratelimit_enabled = false;
+		} else if (!strcmp(tok, "profiles")) {
+			cfg.profiles_enabled = false;
+		} else {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] IFACE...\n"
+		"Attach the keepalive program to the given gre/ip6gre tunnels, or the underlay\n"
+		"program to the given Ethernet interfaces, and keep it attached until SIGINT\n"
+		"or SIGTERM. SIGUSR2 exits leaving everything attached and pinned, the next\n"
+		"instance swaps its programs in without a gap.\n"
+		"\n"
+		"  -m, --mode MODE        XDP mode: auto (default), skb or native\n"
+		"  -M, --malformed ACTION pass, drop (default) or abort truncated packets\n"
+		"  -r, --rate-limit RATE[/BURST]\n"
+		"                         reflect at most RATE keepalives per second and peer\n"
+		"  -A, --allow FILE       only reflect keepalives of peers in these prefixes,\n"
+		"                         reread on SIGHUP\n"
+		"  -P, --profiles FILE    \"ipv4|ipv6 PROTO[,PROTO...] [any-key]\" inner GRE protocols\n"
+		"                         accepted as keepalives, reread on SIGHUP\n"
+		"  -T, --tunnels FILE     \"LOCAL REMOTE [KEY]\" tunnels the underlay program answers for,\n"
+		"                         \"inner LOCAL REMOTE\" after one for its cross-family keepalives\n"
+		"  -k, --keepalive SECS   send keepalives to the tunnels of -T every SECS seconds\n"
+		"  -X, --xsk IFACE[:QUEUE]\n"
+		"                         send them and take in their replies through an AF_XDP\n"
+		"                         socket on QUEUE (default 0) of the underlay IFACE\n"
+		"  -G, --gateway MAC      next hop the AF_XDP keepalives are sent to\n"
+		"  -t, --timeout SECS     report a tunnel down after SECS seconds without keepalives\n"
+		"                         (default: 3 keepalive intervals, or 30)\n"
+		"  -F, --disable FEATURE[,FEATURE...]\n"
+		"                         compile out stats, rate-limit or profiles at load time\n"
+		"  -v, --debug            bpf_printk() every packet to the trace pipe\n"
+		"  -x, --dump-header BYTES\n"
+		"                         also dump the first BYTES (at most %d) of every packet\n"
+		"  -d, --pin-dir DIR      bpffs directory for pins (default " DEFAULT_PIN_DIR ")\n"
+		"  -n, --no-attach        load and pin, but leave attaching to the libxdp\n"
+		"                         dispatcher, which shares the pinned maps\n"
+		"  -u, --unload           detach the links pinned for IFACE... and exit\n",
+		prog, DEBUG_HEADER_MAX);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "mode", required_argument, NULL, 'm' },
+		{ "malformed", required_argument, NULL, 'M' },
+		{ "rate-limit", required_argument, NULL, 'r' },
+		{ "allow", required_argument, NULL, 'A' },
+		{ "profiles", required_argument, NULL, 'P' },
+		{ "tunnels", required_argument, NULL, 'T' },
+		{ "keepalive", required_argument, NULL, 'k' },
+		{ "xsk", required_argument, NULL, 'X' },
+		{ "gateway", required_argument, NULL, 'G' },
+		{ "timeout", required_argument, NULL, 't' },
+		{ "disable", required_argument, NULL, 'F' },
+		{ "debug", no_argument, NULL, 'v' },
+		{ "dump-header", required_argument, NULL, 'x' },
+		{ "pin-dir", required_argument, NULL, 'd' },
+		{ "no-attach", no_argument, NULL, 'n' },
+		{ "unload", no_argument, NULL, 'u' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	struct sigaction sa = { .sa_handler = on_signal };
+	char path[PATH_MAX];
+	bool unload = false;
+	int opt, action, bytes, err = 0;
+
+	// status lines are read from a log file or a pipe as they happen
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	while ((opt = getopt_long(argc, argv, "m:M:r:A:P:T:k:X:G:t:F:vx:d:nuh", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'm':
+			if (!strcmp(optarg, "auto")) {
+				cfg.xdp_flags = 0;
+			} else if (!strcmp(optarg, "skb")) {
+				cfg.xdp_flags = XDP_FLAGS_SKB_MODE;
+			} else if (!strcmp(optarg, "native")) {
+				cfg.xdp_flags = XDP_FLAGS_DRV_MODE;
+			} else {
+				fprintf(stderr, "Unknown mode %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'M':
+			action = parse_xdp_action(optarg);
+			if (action < 0) {
+				fprintf(stderr, "Unknown action %s\n", optarg);
+				return 1;
+			}
+			cfg.malformed_action = action;
+			break;
+		case 'r':
+			if (parse_ratelimit(optarg, &cfg.ratelimit)) {
+				fprintf(stderr, "Invalid rate limit %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'A':
+			cfg.allowlist_file = optarg;
+			break;
+		case 'P':
+			cfg.profiles_file = optarg;
+			break;
+		case 'T':
+			cfg.tunnels_file = optarg;
+			break;
+		case 'k':
+			cfg.keepalive_interval = atoi(optarg);
+			if (cfg.keepalive_interval <= 0) {
+				fprintf(stderr, "Invalid keepalive interval %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'X':
+			if (parse_xsk(optarg)) {
+				fprintf(stderr, "Invalid AF_XDP interface %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'G':
+			if (parse_mac(optarg, cfg.xsk_gateway)) {
+				fprintf(stderr, "Invalid MAC address %s\n", optarg);
+				return 1;
+			}
+			cfg.xsk_gateway_set = true;
+			break;
+		case 't':
+			cfg.liveness_timeout = atoi(optarg);
+			if (cfg.liveness_timeout <= 0) {
+				fprintf(stderr, "Invalid timeout %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'F':
+			if (parse_disable(optarg)) {
+				fprintf(stderr, "Invalid feature list %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'v':
+			cfg.debug_print = true;
+			break;
+		case 'x':
+			bytes = atoi(optarg);
+			if (bytes <= 0 || bytes > DEBUG_HEADER_MAX) {
+				fprintf(stderr, "Invalid dump size %s\n", optarg);
+				return 1;
+			}
+			cfg.debug_header_size = bytes;
+			cfg.debug_print = true;
+			break;
+		case 'd':
+			cfg.pin_dir = optarg;
+			break;
+		case 'n':
+			cfg.no_attach = true;
+			break;
+		case 'u':
+			unload = true;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (unload) {
+		for (int i = optind; i < argc; ++i) {
+			int ret = detach_pinned(argv[i]);
+
+			if (ret < 0) {
+				fprintf(stderr, "%s: detach failed: %s\n", argv[i], strerror(-ret));
+				err = 1;
+			} else if (!ret) {
+				fprintf(stderr, "%s: no pinned link\n", argv[i]);
+			}
+		}
+		return err;
+	}
+
+	if (cfg.xsk_ifname && (!cfg.keepalive_interval || !cfg.xsk_gateway_set)) {
+		fprintf(stderr, "--xsk needs --keepalive and --gateway\n");
+		return 1;
+	}
+	if (!cfg.liveness_timeout)
+		cfg.liveness_timeout = cfg.keepalive_interval ? 3 * cfg.keepalive_interval : 30;
+	if (cfg.allowlist_file) {
+		allowlist_fd = read_allowlist(cfg.allowlist_file);
+		if (allowlist_fd < 0)
+			return 1;
+	}
+	if (cfg.profiles_file && read_profiles(cfg.profiles_file, profiles))
+		return 1;
+	if (cfg.tunnels_file && read_tunnels_file(cfg.tunnels_file, &endpoints, &inners, &nr_endpoints))
+		return 1;
+	for (int i = optind; i < argc; ++i)
+		if (add_tunnel(argv[i]))
+			return 1;
+	// the underlay interfaces share one object, and so one xsks_map whose
+	// sockets only take packets from the interface they are bound to
+	if (cfg.xsk_ifname) {
+		int underlays = 0;
+
+		for (int i = 0; i < nr_tunnels; ++i)
+			underlays += tunnels[i].ko->xsk;
+		if (underlays > 1) {
+			fprintf(stderr, "--xsk works with a single underlay interface\n");
+			return 1;
+		}
+	}
+
+	snprintf(path, sizeof(path), "%s/links", cfg.pin_dir);
+	err = mkdir_p(path);
+	if (err) {
+		fprintf(stderr, "Cannot create %s: %s\n", path, strerror(-err));
+		return 1;
+	}
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = on_sighup;
+	sigaction(SIGHUP, &sa, NULL);
+
+	sa.sa_handler = on_sigusr2;
+	sigaction(SIGUSR2, &sa, NULL);
+
+	for (int i = 0; i < nr_tunnels; ++i) {
+		if (cfg.no_attach ? prepare_tunnel(&tunnels[i]) : attach_tunnel(&tunnels[i])) {
+			err = 1;
+			goto out;
+		}
+	}
+
+	if (run())
+		err = 1;
+
+out:
+	cleanup();
+	return err;
+}
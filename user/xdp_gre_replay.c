@@ -0,0 +1,517 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+// Replay captured packets through the keepalive XDP programs.
+//
+// The replay directory holds one subdirectory per object, named after it
+// (keepalive_gre, ...). Every NAME.pcap in there is fed packet by packet
+// through BPF_PROG_TEST_RUN and the verdict and output frame of each packet
+// are compared with the golden NAME.expect next to it. A tunnels.conf in
+// the subdirectory fills the tunnel_endpoints map of the object.
+//
+// NAME.expect has one line per packet: the verdict, followed by the output
+// frame in hex if the program changed the frame. -u rewrites the .expect
+// files from what the programs currently do.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+#include <linux/types.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include "common_user.h"
+
+#define FRAME_MAX 2048
+#define DEFAULT_REPEAT 10000
+
+#define PCAP_MAGIC_USEC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+
+struct pcap_file_hdr {
+	__u32 magic;
+	__u16 version_major;
+	__u16 version_minor;
+	__s32 thiszone;
+	__u32 sigfigs;
+	__u32 snaplen;
+	__u32 linktype;
+};
+
+struct pcap_rec_hdr {
+	__u32 ts_sec;
+	__u32 ts_frac;
+	__u32 incl_len;
+	__u32 orig_len;
+};
+
+struct packet {
+	__u8 *data;
+	__u32 len;
+};
+
+struct capture {
+	struct packet *packets;
+	int count;
+};
+
+struct expectation {
+	__u32 verdict;
+	// NULL if the frame is expected back unchanged
+	__u8 *data;
+	__u32 len;
+};
+
+static struct {
+	char obj_dir[PATH_MAX];
+	int repeat;
+	bool update;
+} cfg = {
+	.obj_dir = "build",
+	.repeat = DEFAULT_REPEAT,
+};
+
+static void free_capture(struct capture *cap)
+{
+	for (int i = 0; i < cap->count; ++i)
+		free(cap->packets[i].data);
+	free(cap->packets);
+	cap->packets = NULL;
+	cap->count = 0;
+}
+
+// classic pcap files of either byte order; the link type is not checked, each
+// object expects the frames to start where its netdev hands them over
+static int read_pcap(const char *path, struct capture *cap)
+{
+	struct pcap_file_hdr fh;
+	struct pcap_rec_hdr rh;
+	bool swapped;
+	int err = 0;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		err = -errno;
+		fprintf(stderr, "Cannot open %s: %s\n", path, strerror(-err));
+		return err;
+	}
+	if (fread(&fh, sizeof(fh), 1, f) != 1)
+		goto invalid;
+	swapped = fh.magic == __builtin_bswap32(PCAP_MAGIC_USEC) || fh.magic == __builtin_bswap32(PCAP_MAGIC_NSEC);
+	if (!swapped && fh.magic != PCAP_MAGIC_USEC && fh.magic != PCAP_MAGIC_NSEC)
+		goto invalid;
+
+	while (fread(&rh, sizeof(rh), 1, f) == 1) {
+		__u32 len = swapped ? __builtin_bswap32(rh.incl_len) : rh.incl_len;
+		struct packet *pkt;
+
+		if (len > FRAME_MAX)
+			goto invalid;
+		cap->packets = realloc(cap->packets, (cap->count + 1) * sizeof(*cap->packets));
+		if (!cap->packets) {
+			err = -ENOMEM;
+			goto out;
+		}
+		pkt = &cap->packets[cap->count];
+		pkt->len = len;
+		pkt->data = malloc(len ? len : 1);
+		if (!pkt->data) {
+			err = -ENOMEM;
+			goto out;
+		}
+		cap->count++;
+		if (fread(pkt->data, 1, len, f) != len)
+			goto invalid;
+	}
+	goto out;
+
+invalid:
+	fprintf(stderr, "%s: not a valid pcap file\n", path);
+	err = -EINVAL;
+out:
+	fclose(f);
+	if (err)
+		free_capture(cap);
+	return err;
+}
+
+static int parse_verdict(const char *str, __u32 *verdict)
+{
+	for (__u32 v = XDP_ABORTED; v <= XDP_REDIRECT; ++v) {
+		if (!strcmp(str, verdict_name(v))) {
+			*verdict = v;
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+static int parse_hex(const char *str, struct expectation *exp)
+{
+	size_t len = strlen(str);
+
+	if (len % 2 || len / 2 > FRAME_MAX)
+		return -EINVAL;
+	exp->len = len / 2;
+	exp->data = malloc(exp->len ? exp->len : 1);
+	if (!exp->data)
+		return -ENOMEM;
+	for (__u32 i = 0; i < exp->len; ++i) {
+		unsigned int byte;
+
+		if (sscanf(str + 2 * i, "%2x", &byte) != 1)
+			return -EINVAL;
+		exp->data[i] = byte;
+	}
+	return 0;
+}
+
+// returns the number of expectations read, # starts a comment line
+static int read_expect(const char *path, struct expectation *exps, int count)
+{
+	char line[2 * FRAME_MAX + 64], verdict[32], hex[2 * FRAME_MAX + 1];
+	int n = 0, lineno = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		int err = -errno;
+
+		fprintf(stderr, "Cannot open %s: %s\n", path, strerror(-err));
+		return err;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		++lineno;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (n == count) {
+			fprintf(stderr, "%s:%d: more expectations than packets\n", path, lineno);
+			n = -EINVAL;
+			break;
+		}
+		int fields = sscanf(line, "%31s %4096s", verdict, hex);
+
+		if (fields < 1 || parse_verdict(verdict, &exps[n].verdict)
+		    || (fields == 2 && parse_hex(hex, &exps[n]))) {
+			fprintf(stderr, "%s:%d: invalid expectation\n", path, lineno);
+			n = -EINVAL;
+			break;
+		}
+		n++;
+	}
+	fclose(f);
+	return n;
+}
+
+static void write_hex(FILE *f, const __u8 *data, __u32 len)
+{
+	for (__u32 i = 0; i < len; ++i)
+		fprintf(f, "%02x", data[i]);
+}
+
+static int write_expect(const char *path, const char *pcap_name, struct expectation *exps, int count)
+{
+	FILE *f = fopen(path, "w");
+
+	if (!f) {
+		int err = -errno;
+
+		fprintf(stderr, "Cannot create %s: %s\n", path, strerror(-err));
+		return err;
+	}
+	fprintf(f, "# verdict and, if changed, output frame of each packet in %s\n", pcap_name);
+	fprintf(f, "# generated by xdp_gre_replay -u\n");
+	for (int i = 0; i < count; ++i) {
+		fprintf(f, "%s", verdict_name(exps[i].verdict));
+		if (exps[i].data) {
+			fprintf(f, " ");
+			write_hex(f, exps[i].data, exps[i].len);
+		}
+		fprintf(f, "\n");
+	}
+	fclose(f);
+	return 0;
+}
+
+// Run one packet, fill got with the verdict and output frame and return the
+// time the program took in ns, or -1 on error. See xdp_gre_bench for why
+// rewritten frames are timed one run at a time.
+static double run_packet(int prog_fd, const struct packet *pkt, struct expectation *got)
+{
+	__u8 out[FRAME_MAX + 256];
+	__u64 total = 0;
+
+	LIBBPF_OPTS(bpf_test_run_opts, probe,
+		.data_in = pkt->data,
+		.data_size_in = pkt->len,
+		.data_out = out,
+		.data_size_out = sizeof(out),
+		.repeat = 1,
+	);
+	if (bpf_prog_test_run_opts(prog_fd, &probe)) {
+		fprintf(stderr, "test run failed: %s\n", strerror(errno));
+		return -1;
+	}
+	got->verdict = probe.retval;
+	got->data = NULL;
+	got->len = probe.data_size_out;
+	if (probe.data_size_out != pkt->len || memcmp(out, pkt->data, pkt->len)) {
+		got->data = malloc(got->len ? got->len : 1);
+		if (!got->data)
+			return -1;
+		memcpy(got->data, out, got->len);
+		total = probe.duration;
+		for (int i = 1; i < cfg.repeat; ++i) {
+			LIBBPF_OPTS(bpf_test_run_opts, once,
+				.data_in = pkt->data,
+				.data_size_in = pkt->len,
+				.repeat = 1,
+			);
+			if (bpf_prog_test_run_opts(prog_fd, &once))
+				return -1;
+			total += once.duration;
+		}
+		return (double)total / cfg.repeat;
+	}
+
+	LIBBPF_OPTS(bpf_test_run_opts, timed,
+		.data_in = pkt->data,
+		.data_size_in = pkt->len,
+		.repeat = cfg.repeat,
+	);
+	if (bpf_prog_test_run_opts(prog_fd, &timed))
+		return -1;
+	return timed.duration;
+}
+
+static bool same_result(const struct expectation *a, const struct expectation *b)
+{
+	if (a->verdict != b->verdict || !a->data != !b->data)
+		return false;
+	return !a->data || (a->len == b->len && !memcmp(a->data, b->data, a->len));
+}
+
+static void print_result(const char *what, const struct expectation *exp)
+{
+	fprintf(stderr, "    %-8s %s", what, verdict_name(exp->verdict));
+	if (exp->data) {
+		fprintf(stderr, " ");
+		write_hex(stderr, exp->data, exp->len);
+	}
+	fprintf(stderr, "\n");
+}
+
+// returns the number of packets that did not match, or -1 on error
+static int replay_capture(int prog_fd, const char *dir, const char *pcap_name)
+{
+	struct expectation *exps = NULL, *got = NULL;
+	char path[PATH_MAX], expect_path[PATH_MAX];
+	struct capture cap = {};
+	int failed = 0, n = 0;
+	double total_ns = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, pcap_name);
+	snprintf(expect_path, sizeof(expect_path), "%s/%.*s.expect", dir,
+		 (int)(strlen(pcap_name) - strlen(".pcap")), pcap_name);
+	if (read_pcap(path, &cap))
+		return -1;
+
+	exps = calloc(cap.count + 1, sizeof(*exps));
+	got = calloc(cap.count + 1, sizeof(*got));
+	if (!exps || !got) {
+		failed = -1;
+		goto out;
+	}
+	if (!cfg.update) {
+		n = read_expect(expect_path, exps, cap.count);
+		if (n < 0) {
+			failed = -1;
+			goto out;
+		}
+		if (n != cap.count) {
+			fprintf(stderr, "%s: %d packets but %d expectations\n", expect_path, cap.count, n);
+			failed = -1;
+			goto out;
+		}
+	}
+
+	for (int i = 0; i < cap.count; ++i) {
+		double ns = run_packet(prog_fd, &cap.packets[i], &got[i]);
+
+		if (ns < 0) {
+			failed = -1;
+			goto out;
+		}
+		total_ns += ns;
+		if (cfg.update || same_result(&exps[i], &got[i]))
+			continue;
+		fprintf(stderr, "  %s: packet %d differs\n", pcap_name, i + 1);
+		print_result("expected", &exps[i]);
+		print_result("got", &got[i]);
+		failed++;
+	}
+
+	if (cfg.update && write_expect(expect_path, pcap_name, got, cap.count))
+		failed = -1;
+	printf("  %-28s %5d packets %5d failed %10.3f Mpps\n", pcap_name, cap.count, failed > 0 ? failed : 0,
+		total_ns > 0 ? cap.count * 1e3 / total_ns : 0.0);
+
+out:
+	for (int i = 0; i < cap.count; ++i) {
+		if (exps)
+			free(exps[i].data);
+		if (got)
+			free(got[i].data);
+	}
+	free(exps);
+	free(got);
+	free_capture(&cap);
+	return failed;
+}
+
+static int fill_tunnel_endpoints(struct bpf_object *obj, const char *dir)
+{
+	struct tunnel_endpoint *eps = NULL;
+	struct tunnel_inner *inners = NULL;
+	char path[PATH_MAX];
+	int map_fd, count = 0, err = 0;
+
+	map_fd = bpf_object__find_map_fd_by_name(obj, "tunnel_endpoints");
+	snprintf(path, sizeof(path), "%s/tunnels.conf", dir);
+	if (map_fd < 0 || access(path, R_OK))
+		return 0;
+	err = read_tunnels_file(path, &eps, &inners, &count);
+	for (int i = 0; !err && i < count; ++i) {
+		if (bpf_map_update_elem(map_fd, &eps[i], &inners[i], BPF_ANY))
+			err = -errno;
+	}
+	free(eps);
+	free(inners);
+	return err;
+}
+
+static int is_pcap(const struct dirent *ent)
+{
+	size_t len = strlen(ent->d_name);
+
+	return len > strlen(".pcap") && !strcmp(ent->d_name + len - strlen(".pcap"), ".pcap");
+}
+
+// returns the number of packets that did not match, or -1 on error
+static int replay_object(const char *replay_dir, const char *name)
+{
+	char dir[PATH_MAX], path[PATH_MAX];
+	struct bpf_object *obj;
+	struct bpf_program *prog;
+	struct dirent **pcaps;
+	int failed = 0, n;
+
+	snprintf(dir, sizeof(dir), "%s/%s", replay_dir, name);
+	snprintf(path, sizeof(path), "%s/%s.o", cfg.obj_dir, name);
+	obj = xdp_object_open(path);
+	if (!obj)
+		return -1;
+	if (bpf_object__load(obj)) {
+		fprintf(stderr, "%s: load failed: %s\n", path, strerror(errno));
+		bpf_object__close(obj);
+		return -1;
+	}
+	if (fill_tunnel_endpoints(obj, dir)) {
+		bpf_object__close(obj);
+		return -1;
+	}
+	prog = bpf_object__next_program(obj, NULL);
+	printf("%s (%s)\n", name, bpf_program__name(prog));
+
+	n = scandir(dir, &pcaps, is_pcap, alphasort);
+	if (n < 0) {
+		fprintf(stderr, "Cannot read %s: %s\n", dir, strerror(errno));
+		failed = -1;
+	}
+	for (int i = 0; i < n; ++i) {
+		int ret = failed < 0 ? 0 : replay_capture(bpf_program__fd(prog), dir, pcaps[i]->d_name);
+
+		failed = ret < 0 ? -1 : failed + ret;
+		free(pcaps[i]);
+	}
+	if (n >= 0)
+		free(pcaps);
+	bpf_object__close(obj);
+	return failed;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-o OBJ_DIR] [-r REPEAT] [-u] REPLAY_DIR\n"
+		"  -o, --obj-dir DIR      directory holding the keepalive_*.o objects (default build)\n"
+		"  -r, --repeat N         runs per packet for the throughput figures (default %d)\n"
+		"  -u, --update           rewrite the .expect files instead of checking them\n",
+		prog, DEFAULT_REPEAT);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "obj-dir", required_argument, NULL, 'o' },
+		{ "repeat", required_argument, NULL, 'r' },
+		{ "update", no_argument, NULL, 'u' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	struct dirent **objs;
+	int opt, n, failed = 0;
+	bool error = false;
+
+	while ((opt = getopt_long(argc, argv, "o:r:uh", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'o':
+			snprintf(cfg.obj_dir, sizeof(cfg.obj_dir), "%s", optarg);
+			break;
+		case 'r':
+			cfg.repeat = atoi(optarg);
+			if (cfg.repeat <= 0) {
+				fprintf(stderr, "Invalid repeat count: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'u':
+			cfg.update = true;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	n = scandir(argv[optind], &objs, NULL, alphasort);
+	if (n < 0) {
+		fprintf(stderr, "Cannot read %s: %s\n", argv[optind], strerror(errno));
+		return 1;
+	}
+	for (int i = 0; i < n; ++i) {
+		if (objs[i]->d_type == DT_DIR && objs[i]->d_name[0] != '.') {
+			int ret = replay_object(argv[optind], objs[i]->d_name);
+
+			if (ret < 0)
+				error = true;
+			else
+				failed += ret;
+		}
+		free(objs[i]);
+	}
+	free(objs);
+
+	if (failed)
+		printf("%d packets did not match their expectation\n", failed);
+	return error || failed ? 1 : 0;
+}
@@ -0,0 +1,162 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+// Dump the per-reason packet counters of the keepalive program attached to
+// an interface, or of a map pinned by xdp_gre_keepalived. The per-CPU values
+// are summed up in userspace.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <net/if.h>
+#include <linux/types.h>
+#include <linux/bpf.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include "bpf_util.h"
+#include "common_user.h"
+
+#define STATS_MAP_NAME "keepalive_stats"
+
+// find the stats map of the XDP program currently attached to ifindex
+static int find_stats_map(int ifindex)
+{
+	struct bpf_prog_info info = {};
+	__u32 info_len = sizeof(info);
+	__u32 prog_id, map_ids[16];
+	int prog_fd, map_fd = -1;
+
+	if (bpf_xdp_query_id(ifindex, 0, &prog_id) || !prog_id) {
+		fprintf(stderr, "No XDP program attached\n");
+		return -1;
+	}
+	prog_fd = bpf_prog_get_fd_by_id(prog_id);
+	if (prog_fd < 0) {
+		fprintf(stderr, "Cannot open program %u: %s\n", prog_id, strerror(errno));
+		return -1;
+	}
+
+	info.nr_map_ids = sizeof(map_ids) / sizeof(map_ids[0]);
+	info.map_ids = (__u64)(unsigned long)map_ids;
+	if (bpf_prog_get_info_by_fd(prog_fd, &info, &info_len)) {
+		fprintf(stderr, "Cannot get program info: %s\n", strerror(errno));
+		goto out;
+	}
+
+	for (__u32 i = 0; i < info.nr_map_ids && i < sizeof(map_ids) / sizeof(map_ids[0]); ++i) {
+		struct bpf_map_info map_info = {};
+		__u32 map_info_len = sizeof(map_info);
+		int fd = bpf_map_get_fd_by_id(map_ids[i]);
+
+		if (fd < 0)
+			continue;
+		if (!bpf_map_get_info_by_fd(fd, &map_info, &map_info_len)
+		    && !strcmp(map_info.name, STATS_MAP_NAME)) {
+			map_fd = fd;
+			break;
+		}
+		close(fd);
+	}
+	if (map_fd < 0)
+		fprintf(stderr, "Program %u has no %s map\n", prog_id, STATS_MAP_NAME);
+
+out:
+	close(prog_fd);
+	return map_fd;
+}
+
+static int read_stats(int map_fd, __u64 *totals)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	__u64 values[nr_cpus];
+
+	for (__u32 reason = 0; reason < REASON_MAX; ++reason) {
+		if (bpf_map_lookup_elem(map_fd, &reason, values)) {
+			fprintf(stderr, "Cannot read counter %u: %s\n", reason, strerror(errno));
+			return -1;
+		}
+		totals[reason] = 0;
+		for (unsigned int cpu = 0; cpu < nr_cpus; ++cpu)
+			totals[reason] += values[cpu];
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s {-i IFACE | -p PATH} [-w SECONDS]\n"
+		"  -i, --interface IFACE  interface the keepalive program is attached to\n"
+		"  -p, --pinned PATH      pinned " STATS_MAP_NAME " map\n"
+		"  -w, --watch SECONDS    print per-second rates every SECONDS\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "interface", required_argument, NULL, 'i' },
+		{ "pinned", required_argument, NULL, 'p' },
+		{ "watch", required_argument, NULL, 'w' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	__u64 prev[REASON_MAX], cur[REASON_MAX];
+	const char *pin_path = NULL;
+	int ifindex = 0, interval = 0;
+	int opt, map_fd;
+
+	while ((opt = getopt_long(argc, argv, "i:p:w:h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'i':
+			ifindex = if_nametoindex(optarg);
+			if (!ifindex) {
+				fprintf(stderr, "Unknown interface %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'p':
+			pin_path = optarg;
+			break;
+		case 'w':
+			interval = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (!ifindex == !pin_path) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (pin_path) {
+		map_fd = bpf_obj_get(pin_path);
+		if (map_fd < 0)
+			fprintf(stderr, "Cannot open %s: %s\n", pin_path, strerror(errno));
+	} else {
+		map_fd = find_stats_map(ifindex);
+	}
+	if (map_fd < 0)
+		return 1;
+
+	if (read_stats(map_fd, cur))
+		return 1;
+	for (int i = 0; i < REASON_MAX; ++i)
+		printf("%-20s %20llu\n", reason_name(i), (unsigned long long)cur[i]);
+
+	while (interval > 0) {
+		memcpy(prev, cur, sizeof(cur));
+		sleep(interval);
+		if (read_stats(map_fd, cur))
+			return 1;
+		printf("\n");
+		for (int i = 0; i < REASON_MAX; ++i)
+			printf("%-20s %20llu %12.1f pps\n", reason_name(i), (unsigned long long)cur[i],
+				(double)(cur[i] - prev[i]) / interval);
+	}
+
+	close(map_fd);
+	return 0;
+}
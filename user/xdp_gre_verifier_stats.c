@@ -0,0 +1,313 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+// Report what the verifier and the JIT make of the keepalive XDP programs.
+//
+// Every program of the given objects is loaded with the verifier's statistics
+// log, and three figures are recorded for it: the instructions the verifier
+// processed while walking all paths, the instructions of the program after
+// the verifier's rewrites, and the size of the JITed image. The programs are
+// loaded with their default .rodata, which is the configuration the daemon
+// runs without options.
+//
+// The figures are compared with a baseline file holding one line per
+// program: "OBJECT PROGRAM PROCESSED INSNS JITED". Any figure above its
+// baseline fails the run, and so does a program the baseline does not list
+// unless -n says new programs are expected; -u writes the baseline from what
+// the programs need now. The processed count depends on the kernel's
+// verifier, so the baseline is measured on the kernel it is compared on:
+// make verifier-stats writes it from the objects of the base commit first.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <linux/types.h>
+#include <linux/bpf.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include "common_user.h"
+
+#define DEFAULT_BASELINE "build/verifier-stats.base"
+#define LOG_BUF_SIZE (64 * 1024)
+#define MAX_ENTRIES 64
+#define NAME_MAX_LEN 64
+
+// BPF_LOG_STATS, only the summary at the end of verification
+#define LOG_LEVEL_STATS 4
+
+struct prog_stats {
+	char object[NAME_MAX_LEN];
+	char program[NAME_MAX_LEN];
+	__u32 processed;
+	__u32 insns;
+	// 0 if the JIT is disabled
+	__u32 jited;
+};
+
+static struct {
+	const char *baseline;
+	int slack;
+	bool update;
+	bool new_ok;
+} cfg = {
+	.baseline = DEFAULT_BASELINE,
+};
+
+static struct prog_stats baseline[MAX_ENTRIES], current[MAX_ENTRIES];
+static int nr_baseline, nr_current;
+
+// returns the number of entries read, # starts a comment line
+static int read_baseline(const char *path)
+{
+	char line[256];
+	int n = 0, lineno = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		// no baseline yet, everything is new
+		if (errno == ENOENT)
+			return 0;
+		int err = -errno;
+
+		fprintf(stderr, "Cannot open %s: %s\n", path, strerror(-err));
+		return err;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		struct prog_stats *s = &baseline[n];
+
+		++lineno;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (n == MAX_ENTRIES) {
+			fprintf(stderr, "%s:%d: too many programs\n", path, lineno);
+			n = -EINVAL;
+			break;
+		}
+		if (sscanf(line, "%63s %63s %u %u %u", s->object, s->program,
+			   &s->processed, &s->insns, &s->jited) != 5) {
+			fprintf(stderr, "%s:%d: invalid entry\n", path, lineno);
+			n = -EINVAL;
+			break;
+		}
+		n++;
+	}
+	fclose(f);
+	return n;
+}
+
+static int write_baseline(const char *path)
+{
+	FILE *f = fopen(path, "w");
+
+	if (!f) {
+		int err = -errno;
+
+		fprintf(stderr, "Cannot create %s: %s\n", path, strerror(-err));
+		return err;
+	}
+	fprintf(f, "# object program processed-insns prog-insns jited-bytes\n");
+	fprintf(f, "# generated by xdp_gre_verifier_stats -u\n");
+	for (int i = 0; i < nr_current; ++i)
+		fprintf(f, "%s %s %u %u %u\n", current[i].object, current[i].program,
+			current[i].processed, current[i].insns, current[i].jited);
+	fclose(f);
+	return 0;
+}
+
+static const struct prog_stats *find_baseline(const struct prog_stats *s)
+{
+	for (int i = 0; i < nr_baseline; ++i) {
+		if (!strcmp(baseline[i].object, s->object) && !strcmp(baseline[i].program, s->program))
+			return &baseline[i];
+	}
+	return NULL;
+}
+
+// "processed 1234 insns (limit 1000000) max_states_per_insn ..."
+static int parse_processed(const char *log, __u32 *processed)
+{
+	const char *p = strstr(log, "processed ");
+
+	if (!p || sscanf(p, "processed %u insns", processed) != 1)
+		return -ENOENT;
+	return 0;
+}
+
+static int measure_object(const char *path)
+{
+	char obj_name[NAME_MAX_LEN], *logs[MAX_ENTRIES] = {};
+	struct bpf_program *prog;
+	struct bpf_object *obj;
+	int first = nr_current, n = 0, err = 0;
+	char *dot;
+
+	snprintf(obj_name, sizeof(obj_name), "%s", basename((char *)path));
+	dot = strrchr(obj_name, '.');
+	if (dot)
+		*dot = '\0';
+
+	obj = xdp_object_open(path);
+	if (!obj)
+		return -1;
+	bpf_object__for_each_program(prog, obj) {
+		if (nr_current + n == MAX_ENTRIES) {
+			fprintf(stderr, "%s: too many programs\n", path);
+			err = -E2BIG;
+			goto out;
+		}
+		logs[n] = calloc(1, LOG_BUF_SIZE);
+		if (!logs[n]) {
+			err = -ENOMEM;
+			goto out;
+		}
+		bpf_program__set_log_buf(prog, logs[n], LOG_BUF_SIZE);
+		bpf_program__set_log_level(prog, LOG_LEVEL_STATS);
+		n++;
+	}
+	if (bpf_object__load(obj)) {
+		err = -errno;
+		fprintf(stderr, "%s: load failed: %s\n", path, strerror(errno));
+		goto out;
+	}
+
+	n = 0;
+	bpf_object__for_each_program(prog, obj) {
+		struct prog_stats *s = &current[first + n];
+		struct bpf_prog_info info = {};
+		__u32 info_len = sizeof(info);
+
+		snprintf(s->object, sizeof(s->object), "%s", obj_name);
+		snprintf(s->program, sizeof(s->program), "%s", bpf_program__name(prog));
+		if (parse_processed(logs[n], &s->processed)) {
+			fprintf(stderr, "%s: no verifier statistics in the log\n", s->program);
+			err = -ENOENT;
+			goto out;
+		}
+		if (bpf_prog_get_info_by_fd(bpf_program__fd(prog), &info, &info_len)) {
+			err = -errno;
+			fprintf(stderr, "%s: cannot get program info: %s\n", s->program, strerror(errno));
+			goto out;
+		}
+		s->insns = info.xlated_prog_len / sizeof(struct bpf_insn);
+		s->jited = info.jited_prog_len;
+		n++;
+	}
+	nr_current += n;
+
+out:
+	for (int i = 0; i < MAX_ENTRIES; ++i)
+		free(logs[i]);
+	bpf_object__close(obj);
+	return err;
+}
+
+static bool grew(__u32 now, __u32 base)
+{
+	return (__u64)now * 100 > (__u64)base * (100 + cfg.slack);
+}
+
+static void print_figure(const char *what, __u32 now, __u32 base, bool have_base, bool *failed)
+{
+	printf("  %-10s %8u", what, now);
+	if (!have_base) {
+		printf("\n");
+		return;
+	}
+	printf(" (baseline %u, %+d)", base, (int)now - (int)base);
+	if (grew(now, base)) {
+		printf(" GREW");
+		*failed = true;
+	}
+	printf("\n");
+}
+
+// returns the number of programs that grew beyond their baseline or have
+// none
+static int compare(void)
+{
+	int failed = 0;
+
+	for (int i = 0; i < nr_current; ++i) {
+		const struct prog_stats *s = &current[i];
+		const struct prog_stats *b = find_baseline(s);
+		bool grown = false;
+
+		printf("%s (%s)%s\n", s->object, s->program, b ? "" : ": no baseline");
+		print_figure("processed", s->processed, b ? b->processed : 0, b, &grown);
+		print_figure("insns", s->insns, b ? b->insns : 0, b, &grown);
+		// without a JIT on either side there is nothing to compare
+		print_figure("jited", s->jited, b ? b->jited : 0, b && b->jited && s->jited, &grown);
+		failed += grown || (!b && !cfg.new_ok);
+	}
+	return failed;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-b BASELINE] [-s PERCENT] [-n] [-u] OBJ...\n"
+		"  -b, --baseline FILE    figures to compare with (default " DEFAULT_BASELINE ")\n"
+		"  -s, --slack PERCENT    growth tolerated before failing (default 0)\n"
+		"  -n, --new-ok           do not fail on programs missing from the baseline\n"
+		"  -u, --update           rewrite the baseline instead of checking it\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "baseline", required_argument, NULL, 'b' },
+		{ "slack", required_argument, NULL, 's' },
+		{ "new-ok", no_argument, NULL, 'n' },
+		{ "update", no_argument, NULL, 'u' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	int opt, failed;
+
+	while ((opt = getopt_long(argc, argv, "b:s:nuh", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'b':
+			cfg.baseline = optarg;
+			break;
+		case 's':
+			cfg.slack = atoi(optarg);
+			if (cfg.slack < 0) {
+				fprintf(stderr, "Invalid slack: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'n':
+			cfg.new_ok = true;
+			break;
+		case 'u':
+			cfg.update = true;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (int i = optind; i < argc; ++i) {
+		if (measure_object(argv[i]))
+			return 1;
+	}
+
+	if (cfg.update)
+		return write_baseline(cfg.baseline) ? 1 : 0;
+
+	nr_baseline = read_baseline(cfg.baseline);
+	if (nr_baseline < 0)
+		return 1;
+	failed = compare();
+	if (failed)
+		printf("%d programs grew beyond %s or are missing from it\n", failed, cfg.baseline);
+	return failed ? 1 : 0;
+}
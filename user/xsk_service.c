@@ -0,0 +1,523 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+// AF_XDP keepalive service, see xsk_service.h.
+//
+// The UMEM holds two areas. The keepalive frames come first, packed
+// KEEPALIVES_PER_FRAME to a chunk since the kernel only requires a TX
+// descriptor not to cross a chunk; they never change, so a round queues
+// the same descriptors again and completions are only counted. The RX
+// frames follow, all of them owned by the fill ring until a reply lands in
+// one, which goes straight back once the reply is recorded.
+//
+// Only the queue the socket is bound to reaches us. The underlay program
+// records replies on the other queues itself, so steer the replies to this
+// queue (ethtool -N) for the whole load to stay off the kernel's side.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/in.h>
+#include "linux/if_xdp.h"
+#include <bpf/bpf.h>
+#include "keepalive_sender.h"
+#include "liveness_watcher.h"
+#include "xsk_service.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define FRAME_SIZE 2048
+#define RING_SIZE 2048
+#define RX_FRAMES RING_SIZE
+#define RX_BATCH 64
+
+// Ethernet header + the largest keepalive, rounded up
+#define KEEPALIVE_SLOT 128
+#define KEEPALIVES_PER_FRAME (FRAME_SIZE / KEEPALIVE_SLOT)
+
+#define GRE_FLAG_CSUM 0x8000
+#define GRE_FLAG_KEY 0x2000
+
+// producer or consumer side of one of the four rings shared with the kernel
+struct xsk_ring {
+	__u32 *producer;
+	__u32 *consumer;
+	__u32 *flags;
+	void *descs;
+	__u32 size;
+	// our producer index on fill and TX, our consumer index on RX and completion
+	__u32 cached;
+	void *map;
+	size_t map_len;
+};
+
+struct tunnel_state {
+	struct tunnel_endpoint ep;
+	__u64 last_seen;
+	// replies taken in since the last flush_liveness(), 0 if not in the batch
+	__u32 pending;
+};
+
+struct xsk_service {
+	int fd;
+	__u32 queue;
+	int xsks_map_fd;
+	int liveness_map_fd;
+	__u64 timeout_ns;
+	bool in_map;
+
+	__u8 *umem;
+	size_t umem_len;
+	__u64 rx_base;
+	struct xsk_ring fill, comp, rx, tx;
+
+	// sorted by endpoint for bsearch()
+	struct tunnel_state *tunnels;
+	struct xdp_desc *keepalives;
+	int count;
+	// next keepalive of the current round to queue, count when done
+	int next;
+	__u32 outstanding;
+
+	struct tunnel_state *batch_tunnels[RX_BATCH];
+	struct tunnel_endpoint batch_keys[RX_BATCH];
+	struct liveness_info batch_values[RX_BATCH];
+	__u32 batch_len;
+};
+
+static __u64 monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_tunnels(const void *a, const void *b)
+{
+	return memcmp(&((const struct tunnel_state *)a)->ep, &((const struct tunnel_state *)b)->ep,
+		      sizeof(struct tunnel_endpoint));
+}
+
+static int map_ring(int fd, struct xsk_ring *r, const struct xdp_ring_offset *off,
+		    size_t desc_size, __u64 pgoff, bool producer)
+{
+	r->size = RING_SIZE;
+	r->map_len = off->desc + RING_SIZE * desc_size;
+	r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+	if (r->map == MAP_FAILED) {
+		r->map = NULL;
+		return -errno;
+	}
+	r->producer = (__u32 *)((__u8 *)r->map + off->producer);
+	r->consumer = (__u32 *)((__u8 *)r->map + off->consumer);
+	r->flags = (__u32 *)((__u8 *)r->map + off->flags);
+	r->descs = (__u8 *)r->map + off->desc;
+	r->cached = producer ? *r->producer : *r->consumer;
+	return 0;
+}
+
+static void unmap_ring(struct xsk_ring *r)
+{
+	if (r->map)
+		munmap(r->map, r->map_len);
+}
+
+// producer side: free slots, and publishing what was written to them
+static __u32 ring_free(struct xsk_ring *r)
+{
+	return r->size - (r->cached - __atomic_load_n(r->consumer, __ATOMIC_ACQUIRE));
+}
+
+static void ring_submit(struct xsk_ring *r)
+{
+	__atomic_store_n(r->producer, r->cached, __ATOMIC_RELEASE);
+}
+
+// consumer side: filled entries, and handing back what was read
+static __u32 ring_avail(struct xsk_ring *r)
+{
+	return __atomic_load_n(r->producer, __ATOMIC_ACQUIRE) - r->cached;
+}
+
+static void ring_release(struct xsk_ring *r)
+{
+	__atomic_store_n(r->consumer, r->cached, __ATOMIC_RELEASE);
+}
+
+static __u64 *ring_addr(struct xsk_ring *r, __u32 idx)
+{
+	return &((__u64 *)r->descs)[idx & (r->size - 1)];
+}
+
+static struct xdp_desc *ring_desc(struct xsk_ring *r, __u32 idx)
+{
+	return &((struct xdp_desc *)r->descs)[idx & (r->size - 1)];
+}
+
+static int interface_mac(const char *ifname, __u8 *mac)
+{
+	struct ifreq ifr = {};
+	int fd, err = 0;
+
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+	if (ioctl(fd, SIOCGIFHWADDR, &ifr))
+		err = -errno;
+	else
+		memcpy(mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+	close(fd);
+	return err;
+}
+
+static int setup_rings(struct xsk_service *s)
+{
+	struct xdp_umem_reg reg = {
+		.addr = (__u64)(unsigned long)s->umem,
+		.len = s->umem_len,
+		.chunk_size = FRAME_SIZE,
+	};
+	struct xdp_mmap_offsets off;
+	socklen_t optlen = sizeof(off);
+	int size = RING_SIZE, err;
+
+	if (setsockopt(s->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg))
+	    || setsockopt(s->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size))
+	    || setsockopt(s->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size))
+	    || setsockopt(s->fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size))
+	    || setsockopt(s->fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size))
+	    || getsockopt(s->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen))
+		return -errno;
+
+	err = map_ring(s->fd, &s->fill, &off.fr, sizeof(__u64), XDP_UMEM_PGOFF_FILL_RING, true);
+	if (!err)
+		err = map_ring(s->fd, &s->comp, &off.cr, sizeof(__u64), XDP_UMEM_PGOFF_COMPLETION_RING, false);
+	if (!err)
+		err = map_ring(s->fd, &s->rx, &off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING, false);
+	if (!err)
+		err = map_ring(s->fd, &s->tx, &off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING, true);
+	return err;
+}
+
+// every keepalive frame written once, a descriptor for each kept to queue
+static void build_keepalives(struct xsk_service *s, const __u8 *gateway, const __u8 *mac)
+{
+	for (int i = 0; i < s->count; ++i) {
+		const struct tunnel_endpoint *ep = &s->tunnels[i].ep;
+		__u64 addr = (__u64)(i / KEEPALIVES_PER_FRAME) * FRAME_SIZE + (i % KEEPALIVES_PER_FRAME) * KEEPALIVE_SLOT;
+		struct ethhdr *eth = (struct ethhdr *)(s->umem + addr);
+
+		memcpy(eth->h_dest, gateway, ETH_ALEN);
+		memcpy(eth->h_source, mac, ETH_ALEN);
+		eth->h_proto = htons(ep->family == TUNNEL_FAMILY_IPV4 ? ETH_P_IP : ETH_P_IPV6);
+		s->keepalives[i].addr = addr;
+		s->keepalives[i].len = sizeof(*eth) + keepalive_build_packet((__u8 *)(eth + 1), ep);
+	}
+}
+
+struct xsk_service *xsk_service_new(const struct xsk_service_config *cfg,
+				    const struct tunnel_endpoint *eps, int count)
+{
+	struct sockaddr_xdp sxdp = {
+		.sxdp_family = AF_XDP,
+		.sxdp_flags = XDP_USE_NEED_WAKEUP,
+		.sxdp_queue_id = cfg->queue,
+	};
+	struct xdp_options opts = {};
+	socklen_t optlen = sizeof(opts);
+	__u8 mac[ETH_ALEN];
+	struct xsk_service *s;
+	size_t tx_frames;
+	int err;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	s->fd = -1;
+	s->queue = cfg->queue;
+	s->xsks_map_fd = cfg->xsks_map_fd;
+	s->liveness_map_fd = cfg->liveness_map_fd;
+	s->timeout_ns = cfg->timeout_ns;
+
+	sxdp.sxdp_ifindex = if_nametoindex(cfg->ifname);
+	if (!sxdp.sxdp_ifindex || (err = interface_mac(cfg->ifname, mac))) {
+		fprintf(stderr, "%s: cannot get interface: %s\n", cfg->ifname, strerror(errno));
+		goto err;
+	}
+
+	s->count = s->next = count;
+	s->tunnels = calloc(count ? count : 1, sizeof(*s->tunnels));
+	s->keepalives = calloc(count ? count : 1, sizeof(*s->keepalives));
+	if (!s->tunnels || !s->keepalives)
+		goto err;
+	for (int i = 0; i < count; ++i)
+		s->tunnels[i].ep = eps[i];
+	qsort(s->tunnels, count, sizeof(*s->tunnels), compare_tunnels);
+
+	// an even number of chunks keeps the length a multiple of the page size
+	tx_frames = (count + KEEPALIVES_PER_FRAME - 1) / KEEPALIVES_PER_FRAME;
+	tx_frames += tx_frames % 2;
+	s->rx_base = tx_frames * FRAME_SIZE;
+	s->umem_len = (tx_frames + RX_FRAMES) * FRAME_SIZE;
+	s->umem = mmap(NULL, s->umem_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (s->umem == MAP_FAILED) {
+		s->umem = NULL;
+		fprintf(stderr, "Cannot allocate UMEM: %s\n", strerror(errno));
+		goto err;
+	}
+	build_keepalives(s, cfg->gateway, mac);
+
+	s->fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+	if (s->fd < 0) {
+		fprintf(stderr, "Cannot open AF_XDP socket: %s\n", strerror(errno));
+		goto err;
+	}
+	err = setup_rings(s);
+	if (err) {
+		fprintf(stderr, "Cannot set up AF_XDP rings: %s\n", strerror(-err));
+		goto err;
+	}
+	for (__u32 i = 0; i < RX_FRAMES; ++i)
+		*ring_addr(&s->fill, s->fill.cached++) = s->rx_base + (__u64)i * FRAME_SIZE;
+	ring_submit(&s->fill);
+
+	// zero-copy if the driver supports it, copy mode otherwise
+	if (bind(s->fd, (struct sockaddr *)&sxdp, sizeof(sxdp))) {
+		fprintf(stderr, "%s: cannot bind AF_XDP socket to queue %u: %s\n",
+			cfg->ifname, cfg->queue, strerror(errno));
+		goto err;
+	}
+	if (!getsockopt(s->fd, SOL_XDP, XDP_OPTIONS, &opts, &optlen))
+		printf("%s: AF_XDP socket on queue %u in %s mode\n", cfg->ifname, cfg->queue,
+		       opts.flags & XDP_OPTIONS_ZEROCOPY ? "zero-copy" : "copy");
+
+	if (bpf_map_update_elem(s->xsks_map_fd, &s->queue, &s->fd, 0)) {
+		fprintf(stderr, "Cannot add AF_XDP socket to xsks_map: %s\n", strerror(errno));
+		goto err;
+	}
+	s->in_map = true;
+	return s;
+
+err:
+	xsk_service_free(s);
+	return NULL;
+}
+
+int xsk_service_fd(struct xsk_service *s)
+{
+	return s->fd;
+}
+
+short xsk_service_events(struct xsk_service *s)
+{
+	return POLLIN | (s->next < s->count ? POLLOUT : 0);
+}
+
+// queue as much of the round as the TX ring takes, returns how many
+static int queue_keepalives(struct xsk_service *s)
+{
+	__u32 done = ring_avail(&s->comp);
+	__u32 batch;
+
+	// the frames are reused as they are, completions only free ring space
+	s->comp.cached += done;
+	ring_release(&s->comp);
+	s->outstanding -= done;
+
+	batch = ring_free(&s->tx);
+	if (batch > (__u32)(s->count - s->next))
+		batch = s->count - s->next;
+	for (__u32 i = 0; i < batch; ++i)
+		*ring_desc(&s->tx, s->tx.cached++) = s->keepalives[s->next++];
+	ring_submit(&s->tx);
+	s->outstanding += batch;
+
+	if (s->outstanding && *s->tx.flags & XDP_RING_NEED_WAKEUP)
+		sendto(s->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+	return batch;
+}
+
+int xsk_service_send(struct xsk_service *s)
+{
+	// keepalives a slow round did not get to are dropped, not sent late
+	s->next = 0;
+	return queue_keepalives(s);
+}
+
+// The program counts the peer's keepalives in the same entries, so the
+// replies are added to what the map holds rather than written over it. A
+// keepalive the program records between the lookup and the update is lost
+// from the count, last_seen never goes back.
+static void flush_liveness(struct xsk_service *s)
+{
+	__u32 n = s->batch_len;
+
+	if (!n)
+		return;
+	for (__u32 i = 0; i < n; ++i) {
+		struct tunnel_state *t = s->batch_tunnels[i];
+		struct liveness_info *value = &s->batch_values[i], info;
+
+		*value = (struct liveness_info){ .last_seen = t->last_seen, .packets = t->pending };
+		if (!bpf_map_lookup_elem(s->liveness_map_fd, &t->ep, &info)) {
+			if (info.last_seen > value->last_seen)
+				value->last_seen = info.last_seen;
+			value->packets += info.packets;
+		}
+		s->batch_keys[i] = t->ep;
+		t->pending = 0;
+	}
+	// one system call for the batch, one per tunnel on kernels without it
+	if (bpf_map_update_batch(s->liveness_map_fd, s->batch_keys, s->batch_values, &n, NULL)) {
+		for (__u32 i = 0; i < s->batch_len; ++i)
+			bpf_map_update_elem(s->liveness_map_fd, &s->batch_keys[i], &s->batch_values[i], BPF_ANY);
+	}
+	s->batch_len = 0;
+}
+
+// the outer addresses and key of a reply, the program already checked it is one
+static int parse_reply(const __u8 *data, __u32 len, struct tunnel_endpoint *ep)
+{
+	const struct ethhdr *eth = (const struct ethhdr *)data;
+	const __u8 *l3, *gre, *end = data + len;
+	__be16 proto;
+	__u16 flags;
+
+	memset(ep, 0, sizeof(*ep));
+	if (len < sizeof(*eth))
+		return -EINVAL;
+	proto = eth->h_proto;
+	l3 = (const __u8 *)(eth + 1);
+	for (int i = 0; i < VLAN_MAX_DEPTH; ++i) {
+		const struct vlan_hdr *vlh = (const struct vlan_hdr *)l3;
+
+		if (proto != htons(ETH_P_8021Q) && proto != htons(ETH_P_8021AD))
+			break;
+		if ((const __u8 *)(vlh + 1) > end)
+			return -EINVAL;
+		proto = vlh->h_vlan_encapsulated_proto;
+		l3 = (const __u8 *)(vlh + 1);
+	}
+
+	if (proto == htons(ETH_P_IP)) {
+		const struct iphdr *iph = (const struct iphdr *)l3;
+
+		if ((const __u8 *)(iph + 1) > end || iph->protocol != IPPROTO_GRE)
+			return -EINVAL;
+		ep->family = TUNNEL_FAMILY_IPV4;
+		ep->local[0] = iph->daddr;
+		ep->remote[0] = iph->saddr;
+		gre = (const __u8 *)iph + iph->ihl * 4;
+	} else if (proto == htons(ETH_P_IPV6)) {
+		const struct ipv6hdr *ip6h = (const struct ipv6hdr *)l3;
+
+		// our keepalives carry no extension headers, neither do the replies
+		if ((const __u8 *)(ip6h + 1) > end || ip6h->nexthdr != IPPROTO_GRE)
+			return -EINVAL;
+		ep->family = TUNNEL_FAMILY_IPV6;
+		memcpy(ep->local, &ip6h->daddr, sizeof(ep->local));
+		memcpy(ep->remote, &ip6h->saddr, sizeof(ep->remote));
+		gre = (const __u8 *)(ip6h + 1);
+	} else {
+		return -EINVAL;
+	}
+
+	if (gre + 4 > end)
+		return -EINVAL;
+	flags = ntohs(*(const __be16 *)gre);
+	gre += flags & GRE_FLAG_CSUM ? 8 : 4;
+	if (flags & GRE_FLAG_KEY) {
+		if (gre + 4 > end)
+			return -EINVAL;
+		ep->flags = TUNNEL_F_KEY;
+		memcpy(&ep->key, gre, sizeof(ep->key));
+	}
+	return 0;
+}
+
+static void record_reply(struct xsk_service *s, const struct tunnel_endpoint *ep, __u64 now)
+{
+	struct tunnel_state key = { .ep = *ep }, *t;
+	struct liveness_info info;
+
+	t = bsearch(&key, s->tunnels, s->count, sizeof(*s->tunnels), compare_tunnels);
+	if (!t)
+		return;
+
+	// only our own replies are seen here, the program may have heard the
+	// peer's keepalives in the meantime
+	if (now - t->last_seen > s->timeout_ns
+	    && (bpf_map_lookup_elem(s->liveness_map_fd, ep, &info) || now - info.last_seen > s->timeout_ns))
+		liveness_report(ep, TUNNEL_UP);
+	t->last_seen = now;
+	if (t->pending++)
+		return;
+
+	s->batch_tunnels[s->batch_len] = t;
+	if (++s->batch_len == RX_BATCH)
+		flush_liveness(s);
+}
+
+int xsk_service_poll(struct xsk_service *s)
+{
+	__u64 now = monotonic_ns();
+	int received = 0;
+	__u32 n;
+
+	if (s->next < s->count || s->outstanding)
+		queue_keepalives(s);
+
+	while ((n = ring_avail(&s->rx))) {
+		if (n > RX_BATCH)
+			n = RX_BATCH;
+		for (__u32 i = 0; i < n; ++i) {
+			const struct xdp_desc *desc = ring_desc(&s->rx, s->rx.cached++);
+			struct tunnel_endpoint ep;
+
+			if (!parse_reply(s->umem + desc->addr, desc->len, &ep))
+				record_reply(s, &ep, now);
+			// as many RX frames as fill ring slots, there is always room
+			*ring_addr(&s->fill, s->fill.cached++) = desc->addr - desc->addr % FRAME_SIZE;
+		}
+		ring_release(&s->rx);
+		ring_submit(&s->fill);
+		received += n;
+	}
+	flush_liveness(s);
+	return received;
+}
+
+void xsk_service_free(struct xsk_service *s)
+{
+	if (!s)
+		return;
+	if (s->in_map)
+		bpf_map_delete_elem(s->xsks_map_fd, &s->queue);
+	unmap_ring(&s->fill);
+	unmap_ring(&s->comp);
+	unmap_ring(&s->rx);
+	unmap_ring(&s->tx);
+	if (s->fd >= 0)
+		close(s->fd);
+	if (s->umem)
+		munmap(s->umem, s->umem_len);
+	free(s->tunnels);
+	free(s->keepalives);
+	free(s);
+}
@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#pragma once
+#ifndef __XSK_SERVICE_H__
+#define __XSK_SERVICE_H__
+
+#include <linux/types.h>
+#include <linux/if_ether.h>
+#include "../src/common_kern_user.h"
+
+// Originates keepalives and takes in their replies through an AF_XDP socket
+// on one queue of the underlay NIC, instead of raw sockets and the kernel
+// stack. The keepalive frames are built once in the UMEM and every round
+// only queues their descriptors, so a round is a few ring updates and
+// wakeups whatever the number of tunnels. Replies arrive through the XSKMAP
+// of the underlay program and update tunnel_liveness in batches.
+struct xsk_service;
+
+struct xsk_service_config {
+	const char *ifname;
+	__u32 queue;
+	// next hop every keepalive is sent to, the underlay router
+	__u8 gateway[ETH_ALEN];
+	__u64 timeout_ns;
+	int xsks_map_fd;
+	int liveness_map_fd;
+};
+
+struct xsk_service *xsk_service_new(const struct xsk_service_config *cfg,
+				    const struct tunnel_endpoint *eps, int count);
+
+int xsk_service_fd(struct xsk_service *s);
+
+// poll() events to wait for, POLLOUT while a round is still being queued
+short xsk_service_events(struct xsk_service *s);
+
+// start a round: one keepalive to every tunnel, returns how many were queued
+int xsk_service_send(struct xsk_service *s);
+
+// take in replies and carry on with the round, after poll() said so
+int xsk_service_poll(struct xsk_service *s);
+
+void xsk_service_free(struct xsk_service *s);
+
+#endif